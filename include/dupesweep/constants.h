@@ -11,11 +11,101 @@ namespace dupesweep {
     */
     constexpr size_t QUICK_HASH_BYTES = 1024;
 
+    /*
+        files up to this size skip the quick/full distinction:
+        they are read once and that digest is final
+        (default for --small-file-size)
+    */
+    constexpr size_t SMALL_FILE_HASH_BYTES = 64 * 1024;
+
     // similar 4MB buffer for full hash
     constexpr size_t HASH_BUFFER_SIZE = 4 * 1024 * 1024;
 
     constexpr int DEFAULT_THREAD_COUNT = 4;
 
+    /*
+        scheduling lanes for the hashing stages.
+        files up to SMALL_FILE_BYTES go to the small lane and are packed
+        into batches of at most SMALL_BATCH_BYTES / SMALL_BATCH_FILES,
+        so one task amortizes many open/close calls.
+        bigger files get a task of their own in the large lane.
+    */
+    constexpr size_t SMALL_FILE_BYTES = 1024 * 1024;
+    constexpr size_t SMALL_BATCH_BYTES = 16 * 1024 * 1024;
+    constexpr size_t SMALL_BATCH_FILES = 256;
+
+    /*
+        tree hashing: files of at least SPLIT_FILE_BYTES are cut into
+        SEGMENT_BYTES segments that are hashed as separate tasks, so one
+        huge file doesn't leave the run single-threaded at the tail
+        (defaults for --tree-hash-size / --segment-size)
+    */
+    constexpr size_t SPLIT_FILE_BYTES = 1024ull * 1024 * 1024;
+    constexpr size_t SEGMENT_BYTES = 256 * 1024 * 1024;
+    constexpr size_t MIN_SEGMENT_BYTES = 1024 * 1024;
+
+    /*
+        grid for sparse-aware hashing.
+        all-zero blocks (holes or stored zeros) are folded into
+        run-length markers instead of being fed to the hash
+    */
+    constexpr size_t SPARSE_BLOCK_BYTES = 4096;
+
+    // traversal workers started for each device (mount point)
+    constexpr int TRAVERSAL_WORKERS_PER_DEVICE = 2;
+
+    /*
+        directory names pruned during traversal unless --no-default-excludes,
+        version control metadata, snapshot dirs and package caches
+    */
+    constexpr const char* DEFAULT_EXCLUDES[] = {
+        ".git", ".hg", ".svn", ".snapshot", ".snapshots", ".zfs", "node_modules"
+    };
+
+    /*
+        grouping engine: runs shorter than RADIX_SORT_MIN_RECORDS use a
+        comparison sort, from PARALLEL_SORT_RECORDS on the radix sort is
+        split across all threads
+    */
+    constexpr size_t RADIX_SORT_MIN_RECORDS = 256;
+    constexpr size_t PARALLEL_SORT_RECORDS = 64 * 1024;
+
+    // seconds between checkpoints (default for --checkpoint-interval)
+    constexpr int CHECKPOINT_INTERVAL_SECONDS = 300;
+
+    // sanity limit for path lengths read back from a checkpoint
+    constexpr size_t CHECKPOINT_MAX_PATH = 64 * 1024;
+
+    // anytime mode hashes size groups in batches of about this many
+    // candidate bytes (or files). budgets are checked before every hashing
+    // job, a batch only bounds how much is confirmed and reported at once
+    constexpr size_t ANYTIME_BATCH_BYTES = 1024ull * 1024 * 1024;
+    constexpr size_t ANYTIME_BATCH_FILES = 4096;
+
+    /*
+        adaptive mode (--adaptive)
+        probe choice, per size bucket (sizes from a power of two up to the
+        next one): up to TUNE_SAMPLE_GROUPS size groups of the bucket,
+        TUNE_SAMPLE_FILES files each, are quick hashed with every probe size
+        at head, middle and tail. the cheapest probe within
+        TUNE_PROBE_TOLERANCE of the best elimination rate of the bucket wins
+    */
+    constexpr size_t TUNE_SAMPLE_GROUPS = 4;
+    constexpr size_t TUNE_SAMPLE_FILES = 8;
+    constexpr size_t TUNE_PROBE_SIZES[] = {1024, 4 * 1024, 16 * 1024, 64 * 1024};
+    constexpr double TUNE_PROBE_TOLERANCE = 0.01;
+
+    /*
+        device probing: every device with at least TUNE_MIN_DEVICE_BYTES of
+        candidates gets timed reads of TUNE_TRIAL_BYTES, first for each read
+        size with one reader, then with 1, 2, 4, ... readers. the fewest
+        readers within TUNE_CONCURRENCY_TOLERANCE of the best throughput win
+    */
+    constexpr size_t TUNE_READ_SIZES[] = {256 * 1024, 1024 * 1024, 4 * 1024 * 1024};
+    constexpr size_t TUNE_TRIAL_BYTES = 16 * 1024 * 1024;
+    constexpr size_t TUNE_MIN_DEVICE_BYTES = 1024ull * 1024 * 1024;
+    constexpr double TUNE_CONCURRENCY_TOLERANCE = 0.9;
+
     // xxHash seed for consistent results
     constexpr unsigned int XXHASH_SEED = 0;
 }
\ No newline at end of file
@@ -1,8 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -10,20 +10,87 @@ namespace fs = std::filesystem;
 namespace dupesweep {
     using FileSize = uintmax_t;
     using FilePath = fs::path;
-    using FileInfo = std::pair<FilePath, FileSize>;
+    // a scanned file, as seen by the traversal
+    struct FileInfo {
+        FilePath path;
+        FileSize size;
+        int64_t modified;   // mtime in nanoseconds, to notice changed files
+        uint64_t device = 0;    // st_dev, to place work near its disk
+        FileSize allocated = 0; // st_blocks * 512, space on disk
+    };
+
     using FileList = std::vector<FileInfo>;
-    using SizeGroup = std::unordered_map<FileSize, std::vector<FilePath>>;
-    using HashGroup = std::unordered_map<std::string, std::vector<FilePath>>;
+
+    // position of a file in the scanned FileList
+    using FileIndex = size_t;
+
+    // xxhash digest, printed as hex
+    using HashValue = uint64_t;
+
+    // the unit the grouping engine sorts: a key (size or hash) and a file
+    struct KeyedFile {
+        uint64_t key;
+        FileIndex file;
+    };
+
+    /*
+        candidate groups as runs over one flat array of records,
+        group g is records[bounds[g]] .. records[bounds[g+1]-1]
+        and all its records share the same key
+    */
+    struct FileGroups {
+        std::vector<KeyedFile> records;
+        std::vector<size_t> bounds{0};
+
+        size_t count() const{
+            return bounds.size() - 1;
+        }
+
+        size_t size(size_t group) const{
+            return bounds[group + 1] - bounds[group];
+        }
+
+        const KeyedFile* begin(size_t group) const{
+            return records.data() + bounds[group];
+        }
+
+        const KeyedFile* end(size_t group) const{
+            return records.data() + bounds[group + 1];
+        }
+    };
 
     struct DuplicateGroup{
         std::string hash;
         std::vector<FilePath> files;
         FileSize fileSize;
 
+        // identical directory trees instead of files, files then lists the
+        // directories, fileSize and fileCount are per copy of the tree
+        bool directory = false;
+        size_t fileCount = 1;
+
+        // space actually allocated on disk (st_blocks) for each file,
+        // lower than fileSize for sparse files
+        std::vector<FileSize> allocatedSizes;
+
+        // reclaimable space when only the first file is kept
         FileSize wastedSpace() const{
-            return fileSize * (files.size() - 1);
+            if(allocatedSizes.size() != files.size()) {
+                return fileSize * (files.size() - 1);
+            }
+
+            FileSize wasted = 0;
+            for(size_t i=1; i<allocatedSizes.size(); i++) {
+                wasted += allocatedSizes[i];
+            }
+            return wasted;
+        }
+
+        // space freed by deleting the file at index i
+        FileSize allocatedSize(size_t i) const{
+            return i < allocatedSizes.size() ? allocatedSizes[i] : fileSize;
         }
     };
 
     using DuplicateList = std::vector<DuplicateGroup>;
-}
\ No newline at end of file
+}
@@ -0,0 +1,251 @@
+#include "checkpoint.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dupesweep {
+
+namespace {
+
+constexpr char CHECKPOINT_MAGIC[8] = {'D', 'S', 'W', 'P', 'C', 'K', 'P', 'T'};
+constexpr uint32_t CHECKPOINT_VERSION = 5;
+
+// per file flags
+constexpr uint8_t HAS_QUICK = 1;
+constexpr uint8_t HAS_FULL = 2;
+
+class Writer {
+public:
+    explicit Writer(std::ofstream& out): out(out) {}
+
+    void u64(uint64_t value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void u8(uint8_t value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void path(const FilePath& path) {
+        const std::string& text = path.native();
+        u64(text.size());
+        out.write(text.data(), text.size());
+    }
+
+private:
+    std::ofstream& out;
+};
+
+class Reader {
+public:
+    Reader(std::ifstream& in, const FilePath& source): in(in), source(source) {}
+
+    uint64_t u64() {
+        uint64_t value;
+        read(&value, sizeof(value));
+        return value;
+    }
+
+    uint8_t u8() {
+        uint8_t value;
+        read(&value, sizeof(value));
+        return value;
+    }
+
+    FilePath path() {
+        uint64_t length = u64();
+        if(length > CHECKPOINT_MAX_PATH) {
+            throw std::runtime_error("corrupt checkpoint: " + source.string());
+        }
+        std::string text(length, '\0');
+        read(text.data(), length);
+        return FilePath(std::move(text));
+    }
+
+private:
+    void read(void* data, size_t length) {
+        if(!in.read(static_cast<char*>(data), length)) {
+            throw std::runtime_error("truncated checkpoint: " + source.string());
+        }
+    }
+
+    std::ifstream& in;
+    const FilePath& source;
+};
+
+}
+
+Checkpoint::Checkpoint(const Options& options)
+    : options(options), lastSave(std::chrono::steady_clock::now()) {}
+
+bool Checkpoint::enabled() const {
+    return !options.path.empty();
+}
+
+bool Checkpoint::due() const {
+    if(!enabled()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::chrono::steady_clock::now() - lastSave >= std::chrono::seconds(options.intervalSeconds);
+}
+
+void Checkpoint::save(const State& state) {
+    if(!enabled()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    FilePath tempPath = options.path;
+    tempPath += ".tmp";
+
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if(!out) {
+            throw std::runtime_error("cannot create checkpoint: " + tempPath.string());
+        }
+
+        Writer writer(out);
+        out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        writer.u64(CHECKPOINT_VERSION);
+
+        writer.u64(state.roots.size());
+        for(const auto& root: state.roots) {
+            writer.path(root);
+        }
+
+        writer.u64(state.smallFileBytes);
+        writer.u64(state.treeHashBytes);
+        writer.u64(state.segmentBytes);
+        writer.u64(state.probeBytes);
+        writer.u8(state.probeLocation);
+        writer.u64(state.bucketProbes.size());
+        for(const auto& [bucket, probe]: state.bucketProbes) {
+            writer.u64(bucket);
+            writer.u64(probe.first);
+            writer.u8(probe.second);
+        }
+
+        writer.u8(state.traversalDone ? 1 : 0);
+        writer.u64(state.frontier.size());
+        for(const auto& directory: state.frontier) {
+            writer.path(directory);
+        }
+
+        writer.u64(state.uniqueDirectories.size());
+        for(const auto& directory: state.uniqueDirectories) {
+            writer.path(directory);
+        }
+
+        writer.u64(state.files.size());
+        for(size_t i=0; i<state.files.size(); i++) {
+            const FileInfo& file = state.files[i];
+            bool quick = i < state.quickHashes.size() && state.quickHashes[i];
+            bool full = i < state.fullHashes.size() && state.fullHashes[i];
+
+            writer.path(file.path);
+            writer.u64(file.size);
+            writer.u64(static_cast<uint64_t>(file.modified));
+            writer.u8((quick ? HAS_QUICK : 0) | (full ? HAS_FULL : 0));
+            if(quick) writer.u64(*state.quickHashes[i]);
+            if(full) writer.u64(*state.fullHashes[i]);
+        }
+
+        if(!out.flush()) {
+            throw std::runtime_error("cannot write checkpoint: " + tempPath.string());
+        }
+    }
+
+    // make sure the data is on disk before the rename makes it current
+    int fd = ::open(tempPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+
+    fs::rename(tempPath, options.path);
+    lastSave = std::chrono::steady_clock::now();
+}
+
+void Checkpoint::remove() {
+    if(!enabled()) {
+        return;
+    }
+
+    std::error_code ec;
+    fs::remove(options.path, ec);
+}
+
+Checkpoint::State Checkpoint::load(const FilePath& path) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in) {
+        throw std::runtime_error("cannot open checkpoint: " + path.string());
+    }
+
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    if(!in.read(magic, sizeof(magic)) || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0) {
+        throw std::runtime_error("not a DupeSweep checkpoint: " + path.string());
+    }
+
+    Reader reader(in, path);
+    if(reader.u64() != CHECKPOINT_VERSION) {
+        throw std::runtime_error("unsupported checkpoint version: " + path.string());
+    }
+
+    State state;
+    uint64_t rootCount = reader.u64();
+    for(uint64_t i=0; i<rootCount; i++) {
+        state.roots.push_back(reader.path());
+    }
+
+    state.smallFileBytes = reader.u64();
+    state.treeHashBytes = reader.u64();
+    state.segmentBytes = reader.u64();
+    state.probeBytes = reader.u64();
+    state.probeLocation = reader.u8();
+    uint64_t bucketCount = reader.u64();
+    for(uint64_t i=0; i<bucketCount; i++) {
+        uint64_t bucket = reader.u64();
+        uint64_t bytes = reader.u64();
+        state.bucketProbes[bucket] = {bytes, reader.u8()};
+    }
+
+    state.traversalDone = reader.u8() != 0;
+    uint64_t frontierCount = reader.u64();
+    for(uint64_t i=0; i<frontierCount; i++) {
+        state.frontier.push_back(reader.path());
+    }
+
+    uint64_t uniqueCount = reader.u64();
+    for(uint64_t i=0; i<uniqueCount; i++) {
+        state.uniqueDirectories.push_back(reader.path());
+    }
+
+    uint64_t fileCount = reader.u64();
+    for(uint64_t i=0; i<fileCount; i++) {
+        FileInfo file;
+        file.path = reader.path();
+        file.size = reader.u64();
+        file.modified = static_cast<int64_t>(reader.u64());
+
+        uint8_t flags = reader.u8();
+        std::optional<HashValue> quick;
+        std::optional<HashValue> full;
+        if(flags & HAS_QUICK) quick = reader.u64();
+        if(flags & HAS_FULL) full = reader.u64();
+
+        state.files.push_back(std::move(file));
+        state.quickHashes.push_back(quick);
+        state.fullHashes.push_back(full);
+    }
+
+    return state;
+}
+
+}
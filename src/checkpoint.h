@@ -0,0 +1,75 @@
+#pragma once
+
+#include "dupesweep/types.h"
+#include "dupesweep/constants.h"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace dupesweep {
+    /*
+        periodic snapshot of a scan, so a killed run can continue.
+        while walking it holds the traversal frontier and the files found
+        so far, after the walk the size bucket candidates and every quick
+        and full hash computed up to that point
+    */
+    class Checkpoint {
+    public:
+        struct Options {
+            FilePath path;      // empty = no checkpoints
+            bool resume = false;
+            int intervalSeconds = CHECKPOINT_INTERVAL_SECONDS;
+        };
+
+        struct State {
+            std::vector<FilePath> roots;
+
+            // hashing thresholds the digests were made with
+            uint64_t smallFileBytes = 0;
+            uint64_t treeHashBytes = 0;
+            uint64_t segmentBytes = 0;
+
+            // quick hash probe, 0 bytes until the hashing stage starts,
+            // and the probes chosen per size bucket (bytes, location)
+            uint64_t probeBytes = 0;
+            uint8_t probeLocation = 0;
+            std::map<uint64_t, std::pair<uint64_t, uint8_t>> bucketProbes;
+
+            bool traversalDone = false;
+            std::vector<FilePath> frontier;
+            FileList files;
+
+            // directories that can't have an identical twin: the walk left
+            // an entry in them out, or a file was dropped for its unique size
+            std::vector<FilePath> uniqueDirectories;
+
+            // aligned with files once traversalDone is set
+            std::vector<std::optional<HashValue>> quickHashes;
+            std::vector<std::optional<HashValue>> fullHashes;
+        };
+
+        explicit Checkpoint(const Options& options);
+
+        //true if checkpoints are written at all
+        bool enabled() const;
+
+        //true once the interval has passed since the last save
+        bool due() const;
+
+        //write the state atomically (temp file, fsync, rename)
+        void save(const State& state);
+
+        //delete the checkpoint after a finished scan
+        void remove();
+
+        //read a checkpoint, throws if it is missing or malformed
+        static State load(const FilePath& path);
+
+    private:
+        Options options;
+        std::chrono::steady_clock::time_point lastSave;
+        mutable std::mutex mutex;
+    };
+}
@@ -1,19 +1,21 @@
 #include "cli.h"
+#include "dupesweep/constants.h"
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
 #include <cctype>
+#include <cmath>
+#include <limits>
 #include <thread>
 #include <sstream>
 
+#include <sys/sysmacros.h>
+
 namespace dupesweep {
 
 CLI::Options CLI::parseArgs(int argc, char* argv[]) {
     Options options;
 
-    // set default root directory to current directory
-    options.rootDir = fs::current_path();
-
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
 
@@ -27,13 +29,16 @@ CLI::Options CLI::parseArgs(int argc, char* argv[]) {
         else if (arg == "--threads" || arg == "-t") {
             if (i + 1 < argc) {
                 try {
-                    options.numThreads = std::stoi(argv[++i]);
+                    options.hashing.numThreads = std::stoi(argv[++i]);
                 } catch (const std::exception& e) {
                     std::cerr << "invalid thread count: " << argv[i] << std::endl;
                     exit(1);
                 }
             }
         } 
+        else if (arg == "--no-numa") {
+            options.hashing.numa = false;
+        } 
         else if (arg == "--verbose" || arg == "-v") {
             options.verbose = true;
         } 
@@ -41,7 +46,106 @@ CLI::Options CLI::parseArgs(int argc, char* argv[]) {
             options.interactive = false;
         } 
         else if (arg == "--include-hidden") {
-            options.includeHidden = true;
+            options.traversal.includeHidden = true;
+        } 
+        else if (arg == "--one-file-system" || arg == "-x") {
+            options.traversal.oneFileSystem = true;
+        } 
+        else if (arg == "--no-default-excludes") {
+            options.traversal.defaultExcludes = false;
+        } 
+        else if (arg == "--min-size" || arg == "--max-size") {
+            if (i + 1 < argc) {
+                try {
+                    FileSize size = parseSize(argv[++i]);
+                    if (arg == "--min-size") {
+                        options.traversal.minSize = size;
+                    } else {
+                        options.traversal.maxSize = size;
+                    }
+                } catch (const std::exception& e) {
+                    std::cerr << "invalid size: " << argv[i] << std::endl;
+                    exit(1);
+                }
+            }
+        } 
+        else if (arg == "--small-file-size" || arg == "--tree-hash-size" || arg == "--segment-size") {
+            if (i + 1 < argc) {
+                try {
+                    FileSize size = parseSize(argv[++i]);
+                    if (arg == "--small-file-size") {
+                        options.hashing.smallFileBytes = size;
+                    } else if (arg == "--tree-hash-size") {
+                        options.hashing.treeHashBytes = size;
+                    } else {
+                        options.hashing.segmentBytes = size;
+                    }
+                } catch (const std::exception& e) {
+                    std::cerr << "invalid size: " << argv[i] << std::endl;
+                    exit(1);
+                }
+            }
+        } 
+        else if (arg == "--include" || arg == "--exclude") {
+            if (i + 1 < argc) {
+                auto& globs = arg == "--include" ? options.traversal.includeGlobs
+                                                 : options.traversal.excludeGlobs;
+                globs.push_back(argv[++i]);
+            }
+        } 
+        else if (arg == "--save-index" || arg == "--query-index") {
+            if (i + 1 < argc) {
+                (arg == "--save-index" ? options.saveIndex : options.queryIndex) = argv[++i];
+            }
+        } 
+        else if (arg == "--adaptive") {
+            options.detection.adaptive = true;
+        } 
+        else if (arg == "--anytime") {
+            options.detection.anytime = true;
+        } 
+        else if (arg == "--time-limit") {
+            if (i + 1 < argc) {
+                try {
+                    options.detection.timeLimitSeconds = std::stoi(argv[++i]);
+                    options.detection.anytime = true;
+                } catch (const std::exception& e) {
+                    std::cerr << "invalid time limit: " << argv[i] << std::endl;
+                    exit(1);
+                }
+            }
+        } 
+        else if (arg == "--byte-budget") {
+            if (i + 1 < argc) {
+                try {
+                    options.detection.byteBudget = parseSize(argv[++i]);
+                    options.detection.anytime = true;
+                } catch (const std::exception& e) {
+                    std::cerr << "invalid size: " << argv[i] << std::endl;
+                    exit(1);
+                }
+            }
+        } 
+        else if (arg == "--dirs") {
+            options.detection.directories = true;
+        } 
+        else if (arg == "--checkpoint") {
+            if (i + 1 < argc) {
+                options.checkpoint.path = argv[++i];
+            }
+        } 
+        else if (arg == "--resume") {
+            options.checkpoint.resume = true;
+        } 
+        else if (arg == "--checkpoint-interval") {
+            if (i + 1 < argc) {
+                try {
+                    options.checkpoint.intervalSeconds = std::stoi(argv[++i]);
+                } catch (const std::exception& e) {
+                    std::cerr << "invalid interval: " << argv[i] << std::endl;
+                    exit(1);
+                }
+            }
         } 
         else if (arg == "--format") {
             if (i + 1 < argc) {
@@ -58,8 +162,8 @@ CLI::Options CLI::parseArgs(int argc, char* argv[]) {
                 }
             }
         } else if (arg[0] != '-') {
-            // assume it's the directory path
-            options.rootDir = arg;
+            // assume it's a directory path
+            options.traversal.roots.push_back(arg);
         } else {
             std::cerr << "unknown option: " << arg << std::endl;
             showUsage(argv[0]);
@@ -67,23 +171,74 @@ CLI::Options CLI::parseArgs(int argc, char* argv[]) {
         }
     }
 
-    // validate the root directory
-    if (!fs::exists(options.rootDir)) {
-        std::cerr << "error: Directory does not exist: " << options.rootDir << std::endl;
+    // default root directory is the current directory
+    if (options.traversal.roots.empty()) {
+        options.traversal.roots.push_back(fs::current_path());
+    }
+
+    // validate the root directories
+    for (const auto& root : options.traversal.roots) {
+        if (!fs::exists(root)) {
+            std::cerr << "error: Directory does not exist: " << root << std::endl;
+            exit(1);
+        }
+
+        if (!fs::is_directory(root)) {
+            std::cerr << "error: Not a directory: " << root << std::endl;
+            exit(1);
+        }
+    }
+
+    if (!options.saveIndex.empty() && !options.queryIndex.empty()) {
+        std::cerr << "error: --save-index and --query-index can't be combined" << std::endl;
+        exit(1);
+    }
+
+    if (options.detection.anytime && options.detection.directories) {
+        std::cerr << "error: --dirs needs a complete scan, it can't be combined with anytime mode" << std::endl;
         exit(1);
     }
 
-    if (!fs::is_directory(options.rootDir)) {
-        std::cerr << "error: Not a directory: " << options.rootDir << std::endl;
+    if (options.detection.timeLimitSeconds < 0) {
+        std::cerr << "error: --time-limit can't be negative" << std::endl;
+        exit(1);
+    }
+
+    if (options.checkpoint.resume && options.checkpoint.path.empty()) {
+        std::cerr << "error: --resume needs --checkpoint <file>" << std::endl;
+        exit(1);
+    }
+
+    if (options.checkpoint.intervalSeconds <= 0) {
+        std::cerr << "error: --checkpoint-interval must be positive" << std::endl;
+        exit(1);
+    }
+
+    // small files are read whole into a buffer per worker
+    if (options.hashing.smallFileBytes > SMALL_FILE_BYTES) {
+        std::cerr << "error: --small-file-size can be at most " << formatSize(SMALL_FILE_BYTES) << std::endl;
+        exit(1);
+    }
+
+    // segments start on the sparse hashing grid
+    if (options.hashing.segmentBytes < MIN_SEGMENT_BYTES ||
+        options.hashing.segmentBytes % SPARSE_BLOCK_BYTES != 0) {
+        std::cerr << "error: --segment-size must be a multiple of " << SPARSE_BLOCK_BYTES
+                  << " and at least " << formatSize(MIN_SEGMENT_BYTES) << std::endl;
+        exit(1);
+    }
+
+    if (options.traversal.minSize > options.traversal.maxSize) {
+        std::cerr << "error: --min-size is larger than --max-size" << std::endl;
         exit(1);
     }
 
     // set default thread count if not specified
-    if (options.numThreads <= 0) {
-        options.numThreads = std::thread::hardware_concurrency();
-        if (options.numThreads == 0) {
+    if (options.hashing.numThreads <= 0) {
+        options.hashing.numThreads = std::thread::hardware_concurrency();
+        if (options.hashing.numThreads == 0) {
             // default to 4 threads if detection fails
-            options.numThreads = 4;
+            options.hashing.numThreads = 4;
         }
     }
 
@@ -91,18 +246,39 @@ CLI::Options CLI::parseArgs(int argc, char* argv[]) {
 }
 
 void CLI::showUsage(const char* programName) {
-    std::cout << "Usage: " << programName << " [options] [directory]" << std::endl;
+    std::cout << "Usage: " << programName << " [options] [directory...]" << std::endl;
     std::cout << std::endl;
     std::cout << "Options:" << std::endl;
     std::cout << "  -h, --help                Show this help message" << std::endl;
     std::cout << "  --delete                  Delete duplicate files (default is dry-run)" << std::endl;
     std::cout << "  -t, --threads <num>       Number of threads to use" << std::endl;
+    std::cout << "  --no-numa                 Don't pin hashing workers to NUMA nodes" << std::endl;
     std::cout << "  -v, --verbose             Enable verbose output" << std::endl;
     std::cout << "  --non-interactive         Disable interactive mode" << std::endl;
     std::cout << "  --include-hidden          Include hidden files in scan" << std::endl;
+    std::cout << "  --min-size <size>         Skip files smaller than size (e.g. 4K, 10M)" << std::endl;
+    std::cout << "  --max-size <size>         Skip files larger than size" << std::endl;
+    std::cout << "  --include <glob>          Only scan files matching glob (repeatable)" << std::endl;
+    std::cout << "  --exclude <glob>          Skip files and directories matching glob (repeatable)" << std::endl;
+    std::cout << "  --no-default-excludes     Also scan .git, snapshot dirs, node_modules, ..." << std::endl;
+    std::cout << "  -x, --one-file-system     Don't cross mount points" << std::endl;
+    std::cout << "  --small-file-size <size>  Hash files up to size in a single read (default 64K)" << std::endl;
+    std::cout << "  --tree-hash-size <size>   Hash files from size on in parallel segments, 0 = off (default 1G)" << std::endl;
+    std::cout << "  --segment-size <size>     Segment size for tree hashing (default 256M)" << std::endl;
+    std::cout << "  --save-index <file>       Hash every file and save a content index, then exit" << std::endl;
+    std::cout << "  --query-index <file>      Report files that already exist in a saved index" << std::endl;
+    std::cout << "  --adaptive                Tune quick hash probes, read size and concurrency to the data" << std::endl;
+    std::cout << "  --anytime                 Hash the biggest potential savings first, print groups as found" << std::endl;
+    std::cout << "  --time-limit <s>          Stop anytime mode after s seconds" << std::endl;
+    std::cout << "  --byte-budget <size>      Stop anytime mode after hashing about size bytes" << std::endl;
+    std::cout << "  --dirs                    Report identical directory trees instead of the files in them" << std::endl;
+    std::cout << "  --checkpoint <file>       Save the scan state to file periodically" << std::endl;
+    std::cout << "  --resume                  Continue the scan saved in the --checkpoint file" << std::endl;
+    std::cout << "  --checkpoint-interval <s> Seconds between checkpoints (default 300)" << std::endl;
     std::cout << "  --format <format>         Output format: text, json, csv" << std::endl;
     std::cout << std::endl;
-    std::cout << "If directory is not specified, the current directory is used." << std::endl;
+    std::cout << "Several directories can be given. If none is specified, the current directory is used." << std::endl;
+    std::cout << "Globs without '/' match file and directory names, globs with '/' match full paths." << std::endl;
 }
 
 void CLI::displayDuplicates(const DuplicateList& duplicates) {
@@ -113,18 +289,70 @@ void CLI::displayDuplicates(const DuplicateList& duplicates) {
 
     int groupCount = 0;
     for (const auto& group : duplicates) {
-        groupCount++;
-        std::cout << "Duplicate group #" << groupCount
+        displayGroup(group, ++groupCount);
+    }
+}
+
+void CLI::displayGroup(const DuplicateGroup& group, int number) {
+    if (group.directory) {
+        std::cout << "Duplicate directory #" << number
                   << " (Size: " << formatSize(group.fileSize)
+                  << ", Files: " << group.fileCount
                   << ", Hash: " << group.hash << ")" << std::endl;
+    } else {
+        std::cout << "Duplicate group #" << number
+                  << " (Size: " << formatSize(group.fileSize)
+                  << ", Hash: " << group.hash << ")" << std::endl;
+    }
 
-        int fileCount = 0;
-        for (const auto& file : group.files) {
-            fileCount++;
-            std::cout << "  " << fileCount << ". " << file.string() << std::endl;
+    int fileCount = 0;
+    for (const auto& file : group.files) {
+        fileCount++;
+        std::cout << "  " << fileCount << ". " << file.string() << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+void CLI::displayStats(const DuplicateDetection::Stats& stats) {
+    const Tuning::Report& tuning = stats.tuning;
+    if (tuning.enabled) {
+        static const char* locations[] = {"head", "middle", "tail"};
+        std::cout << "Adaptive parameters:" << std::endl;
+        if (tuning.buckets.empty()) {
+            std::cout << "  Quick hash probe: default" << std::endl;
+        } else {
+            std::cout << "  Quick hash probes" << (tuning.probeReused ? " (from checkpoint):" : ":") << std::endl;
         }
-        std::cout << std::endl;
+        for (const auto& bucket : tuning.buckets) {
+            std::cout << "    " << formatSize(bucket.bucket) << " - " << formatSize(bucket.bucket * 2) << ": "
+                      << formatSize(bucket.probe.bytes) << " at the " << locations[static_cast<int>(bucket.probe.location)];
+            if (bucket.sampledFiles > 0) {
+                std::cout << " (eliminated " << std::fixed << std::setprecision(1)
+                          << bucket.eliminationRate * 100 << "% of " << bucket.sampledFiles << " sampled files)";
+            }
+            std::cout << std::endl;
+        }
+
+        for (const auto& device : tuning.devices) {
+            std::cout << "  Device " << major(device.device) << ":" << minor(device.device)
+                      << ": read size " << formatSize(device.settings.readBytes) << ", ";
+            if (device.settings.concurrency > 0) {
+                std::cout << device.settings.concurrency << " concurrent reads";
+            } else {
+                std::cout << "no concurrency limit";
+            }
+            std::cout << " (" << std::fixed << std::setprecision(0) << device.megabytesPerSecond << " MB/s)" << std::endl;
+        }
+    }
+
+    if (stats.complete) {
+        return;
     }
+
+    std::cout << "Stopped early, not examined: " << stats.unexaminedGroups << " size groups ("
+              << stats.unexaminedFiles << " files), up to "
+              << formatSize(stats.unexaminedWaste) << " of potential duplicates" << std::endl;
+    std::cout << "  Hashed: " << formatSize(stats.bytesRead) << std::endl;
 }
 
 void CLI::displaySummary(const DuplicateList& duplicates) {
@@ -139,7 +367,7 @@ void CLI::displaySummary(const DuplicateList& duplicates) {
     FileSize totalWasted = 0;
 
     for (const auto& group : duplicates) {
-        totalFiles += group.files.size();
+        totalFiles += group.files.size() * group.fileCount;
         totalWasted += group.wastedSpace();
     }
 
@@ -170,9 +398,9 @@ void CLI::handleDuplicateDeletion(DuplicateList& duplicates, bool dryRun, bool i
             // keep the first file, delete the rest
             for (size_t i = 1; i < group.files.size(); i++) {
                 try {
-                    fs::remove(group.files[i]);
-                    deletedFiles++;
-                    freedSpace += group.fileSize;
+                    removeEntry(group, i);
+                    deletedFiles += group.fileCount;
+                    freedSpace += group.allocatedSize(i);
                 } catch (const fs::filesystem_error& e) {
                     std::cerr << "error deleting file " << group.files[i]
                               << ": " << e.what() << std::endl;
@@ -202,7 +430,7 @@ void CLI::handleDuplicateDeletion(DuplicateList& duplicates, bool dryRun, bool i
         groupIndex++;
 
         std::cout << std::endl;
-        std::cout << "Group " << groupIndex << "/" << duplicates.size()
+        std::cout << (group.directory ? "Directory group " : "Group ") << groupIndex << "/" << duplicates.size()
                   << " (Size: " << formatSize(group.fileSize) << ")" << std::endl;
 
         for (size_t i = 0; i < group.files.size(); i++) {
@@ -244,9 +472,9 @@ void CLI::handleDuplicateDeletion(DuplicateList& duplicates, bool dryRun, bool i
             if (std::find(filesToKeep.begin(), filesToKeep.end(), i) == filesToKeep.end()) {
                 try {
                     std::cout << "Deleting: " << group.files[i].string() << std::endl;
-                    fs::remove(group.files[i]);
-                    deletedFiles++;
-                    freedSpace += group.fileSize;
+                    removeEntry(group, i);
+                    deletedFiles += group.fileCount;
+                    freedSpace += group.allocatedSize(i);
                 } catch (const fs::filesystem_error& e) {
                     std::cerr << "error deleting file " << group.files[i]
                               << ": " << e.what() << std::endl;
@@ -260,6 +488,43 @@ void CLI::handleDuplicateDeletion(DuplicateList& duplicates, bool dryRun, bool i
               << formatSize(freedSpace) << " of space." << std::endl;
 }
 
+// a directory group deletes the whole tree of that copy
+void CLI::removeEntry(const DuplicateGroup& group, size_t i) {
+    if (group.directory) {
+        fs::remove_all(group.files[i]);
+    } else {
+        fs::remove(group.files[i]);
+    }
+}
+
+FileSize CLI::parseSize(const std::string& text) {
+    size_t consumed = 0;
+    double value = std::stod(text, &consumed);
+    if (value < 0) {
+        throw std::invalid_argument("negative size");
+    }
+
+    std::string unit = text.substr(consumed);
+    std::transform(unit.begin(), unit.end(), unit.begin(),
+                   [](unsigned char c){ return std::toupper(c); });
+
+    const std::string units[] = {"B", "K", "M", "G", "T"};
+    for (int i = 0; i < 5; i++) {
+        if (unit.empty() || unit == units[i] || unit == units[i] + "B" || unit == units[i] + "IB") {
+            double bytes = value * std::pow(1024.0, unit.empty() ? 0 : i);
+
+            // nan, inf and anything past FileSize can't be converted
+            // (max() rounds up to 2^64 as a double, hence the strict <)
+            if (!std::isfinite(bytes) || !(bytes < static_cast<double>(std::numeric_limits<FileSize>::max()))) {
+                throw std::out_of_range("size out of range: " + text);
+            }
+            return static_cast<FileSize>(bytes);
+        }
+    }
+
+    throw std::invalid_argument("unknown size unit: " + unit);
+}
+
 std::string CLI::formatSize(FileSize size) {
     const char* units[] = {"B", "KB", "MB", "GB", "TB"};
     int unitIndex = 0;
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "dupesweep/types.h"
+#include "checkpoint.h"
+#include "duplicate_detection.h"
+#include "file_traversal.h"
+#include "hashing.h"
 #include <string>
 #include <vector>
 
@@ -8,13 +12,16 @@ namespace dupesweep {
     class CLI {
     public:
         struct Options {
-            FilePath rootDir;
+            FileTraversal::Options traversal;
+            Hashing::Options hashing;
+            Checkpoint::Options checkpoint;
+            DuplicateDetection::Options detection;
             bool dryRun = true;
-            int numThreads = 0;
             bool verbose = false;
             bool interactive = true;
-            bool includeHidden = false;
             std::string outputFormat = "text";
+            FilePath saveIndex;   // write a content index of the scan and exit
+            FilePath queryIndex;  // report files that already exist in this index
         };
 
         // parse cli arguments
@@ -26,13 +33,26 @@ namespace dupesweep {
         // displau duplicate files
         static void displayDuplicates(const DuplicateList& duplicates);
 
+        // display one group, as numbered in the output
+        static void displayGroup(const DuplicateGroup& group, int number);
+
+        // display what an early stopped scan left unexamined
+        static void displayStats(const DuplicateDetection::Stats& stats);
+
         // display summary info
         static void displaySummary(const DuplicateList& duplicates);
 
         // delete duplicate files interactively
         static void handleDuplicateDeletion(DuplicateList& duplicates, bool dryRun, bool interactive);
         
+        // parse a size like "4096", "64K", "1.5G" (binary units)
+        static FileSize parseSize(const std::string& text);
+
         // format file size in human-readable format
         static std::string formatSize(FileSize size);
+
+    private:
+        // delete one copy of a group (a file or a whole directory tree)
+        static void removeEntry(const DuplicateGroup& group, size_t i);
     };
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "content_index.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dupesweep {
+
+namespace {
+
+constexpr char INDEX_MAGIC[8] = {'D', 'S', 'W', 'P', 'I', 'D', 'X', '1'};
+constexpr uint32_t INDEX_VERSION = 3;
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t entryCount;
+    uint64_t pathBytes;
+    ContentIndex::Scheme scheme;
+};
+
+bool entryLess(const ContentIndex::Entry& a, const ContentIndex::Entry& b) {
+    return std::tie(a.size, a.quickHash, a.fullHash) < std::tie(b.size, b.quickHash, b.fullHash);
+}
+
+}
+
+void ContentIndex::save(const FilePath& indexPath, std::vector<Record> records, const Scheme& scheme) {
+    std::sort(records.begin(), records.end(), [](const Record& a, const Record& b) {
+        return std::tie(a.size, a.quickHash, a.fullHash) < std::tie(b.size, b.quickHash, b.fullHash);
+    });
+
+    std::vector<Entry> entries;
+    entries.reserve(records.size());
+    std::string pathBlob;
+
+    for(const auto& record: records) {
+        entries.push_back({record.size, record.quickHash, record.fullHash, pathBlob.size()});
+        pathBlob += record.path.string();
+        pathBlob += '\0';
+    }
+
+    Header header;
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.entryCount = entries.size();
+    header.pathBytes = pathBlob.size();
+    header.scheme = scheme;
+
+    // write next to the target and rename, so a crash never leaves half an index
+    FilePath tempPath = indexPath;
+    tempPath += ".tmp";
+
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if(!file) {
+            throw std::runtime_error("cannot create index file: " + tempPath.string());
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+        file.write(pathBlob.data(), pathBlob.size());
+
+        if(!file.flush()) {
+            throw std::runtime_error("cannot write index file: " + tempPath.string());
+        }
+    }
+
+    fs::rename(tempPath, indexPath);
+}
+
+ContentIndex ContentIndex::open(const FilePath& indexPath) {
+    int fd = ::open(indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        throw std::runtime_error("cannot open index file: " + indexPath.string() + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        ::close(fd);
+        throw std::runtime_error("not a DupeSweep index: " + indexPath.string());
+    }
+
+    ContentIndex index;
+    index.mappingSize = st.st_size;
+    index.mapping = ::mmap(nullptr, index.mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if(index.mapping == MAP_FAILED) {
+        index.mapping = nullptr;
+        throw std::runtime_error("cannot map index file: " + indexPath.string());
+    }
+
+    const char* base = static_cast<const char*>(index.mapping);
+    Header header;
+    std::memcpy(&header, base, sizeof(header));
+
+    if(std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+       header.version != INDEX_VERSION ||
+       header.byteOrder != BYTE_ORDER_MARK) {
+        throw std::runtime_error("not a DupeSweep index (or written on another platform): " + indexPath.string());
+    }
+
+    if(header.entryCount > (index.mappingSize - sizeof(Header)) / sizeof(Entry) ||
+       sizeof(Header) + header.entryCount * sizeof(Entry) + header.pathBytes != index.mappingSize) {
+        throw std::runtime_error("truncated index file: " + indexPath.string());
+    }
+
+    index.entries = reinterpret_cast<const Entry*>(base + sizeof(Header));
+    index.entryCount = header.entryCount;
+    index.paths = base + sizeof(Header) + header.entryCount * sizeof(Entry);
+    index.pathBytes = header.pathBytes;
+    index.digestScheme = header.scheme;
+
+    ::madvise(index.mapping, index.mappingSize, MADV_RANDOM);
+
+    return index;
+}
+
+ContentIndex::ContentIndex(ContentIndex&& other) noexcept {
+    *this = std::move(other);
+}
+
+ContentIndex& ContentIndex::operator=(ContentIndex&& other) noexcept {
+    if(this != &other) {
+        if(mapping != nullptr) {
+            ::munmap(mapping, mappingSize);
+        }
+        mapping = std::exchange(other.mapping, nullptr);
+        mappingSize = std::exchange(other.mappingSize, 0);
+        entries = std::exchange(other.entries, nullptr);
+        entryCount = std::exchange(other.entryCount, 0);
+        paths = std::exchange(other.paths, nullptr);
+        pathBytes = std::exchange(other.pathBytes, 0);
+        digestScheme = other.digestScheme;
+    }
+    return *this;
+}
+
+ContentIndex::~ContentIndex() {
+    if(mapping != nullptr) {
+        ::munmap(mapping, mappingSize);
+    }
+}
+
+std::pair<const ContentIndex::Entry*, const ContentIndex::Entry*> ContentIndex::findSize(uint64_t size) const {
+    Entry low{size, 0, 0, 0};
+    Entry high{size, UINT64_MAX, UINT64_MAX, 0};
+    auto first = std::lower_bound(entries, entries + entryCount, low, entryLess);
+    auto last = std::upper_bound(first, entries + entryCount, high, entryLess);
+    return {first, last};
+}
+
+std::pair<const ContentIndex::Entry*, const ContentIndex::Entry*> ContentIndex::find(uint64_t size, uint64_t quickHash) const {
+    Entry low{size, quickHash, 0, 0};
+    Entry high{size, quickHash, UINT64_MAX, 0};
+    auto first = std::lower_bound(entries, entries + entryCount, low, entryLess);
+    auto last = std::upper_bound(first, entries + entryCount, high, entryLess);
+    return {first, last};
+}
+
+const char* ContentIndex::path(const Entry& entry) const {
+    if(entry.pathOffset >= pathBytes) {
+        return "";
+    }
+    return paths + entry.pathOffset;
+}
+
+size_t ContentIndex::size() const {
+    return entryCount;
+}
+
+const ContentIndex::Scheme& ContentIndex::scheme() const {
+    return digestScheme;
+}
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "dupesweep/types.h"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dupesweep {
+    /*
+        compact on-disk index of a scan, meant to be memory mapped.
+
+        layout (native byte order, checked through the header):
+            Header
+            Entry[entryCount]      sorted by (size, quickHash, fullHash)
+            path blob              NUL terminated paths, Entry::pathOffset points here
+
+        lookups are a binary search on (size, quick hash) straight in the
+        mapping, so opening an index costs nothing and probing touches only
+        a few pages
+    */
+    class ContentIndex {
+    public:
+        struct Entry {
+            uint64_t size;
+            uint64_t quickHash;
+            uint64_t fullHash;
+            uint64_t pathOffset;
+        };
+
+        // one scanned file, used to build an index
+        struct Record {
+            FilePath path;
+            FileSize size;
+            uint64_t quickHash;
+            uint64_t fullHash;
+        };
+
+        // hashing thresholds the digests were made with,
+        // a query has to hash the same way
+        struct Scheme {
+            uint64_t smallFileBytes;
+            uint64_t treeHashBytes;
+            uint64_t segmentBytes;
+        };
+
+        //write an index for the given records (atomically, via rename)
+        static void save(const FilePath& indexPath, std::vector<Record> records, const Scheme& scheme);
+
+        //map an existing index, throws if it is missing or malformed
+        static ContentIndex open(const FilePath& indexPath);
+
+        ContentIndex(ContentIndex&& other) noexcept;
+        ContentIndex& operator=(ContentIndex&& other) noexcept;
+        ContentIndex(const ContentIndex&) = delete;
+        ContentIndex& operator=(const ContentIndex&) = delete;
+        ~ContentIndex();
+
+        //entries with the given size (possibly empty range)
+        std::pair<const Entry*, const Entry*> findSize(uint64_t size) const;
+
+        //entries with the given size and quick hash (possibly empty range)
+        std::pair<const Entry*, const Entry*> find(uint64_t size, uint64_t quickHash) const;
+
+        //path of an indexed file
+        const char* path(const Entry& entry) const;
+
+        //number of indexed files
+        size_t size() const;
+
+        //hashing thresholds the index was built with
+        const Scheme& scheme() const;
+
+    private:
+        ContentIndex() = default;
+
+        void* mapping = nullptr;
+        size_t mappingSize = 0;
+        const Entry* entries = nullptr;
+        size_t entryCount = 0;
+        const char* paths = nullptr;
+        size_t pathBytes = 0;
+        Scheme digestScheme{};
+    };
+}
@@ -0,0 +1,301 @@
+#include "directory_hashing.h"
+#include "hashing.h"
+#include "dupesweep/constants.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <xxhash.h>
+
+namespace dupesweep {
+
+namespace {
+
+constexpr size_t NO_NODE = std::numeric_limits<size_t>::max();
+
+struct Node {
+    FilePath path;
+    size_t parent = NO_NODE;
+    std::vector<size_t> children;
+    std::vector<FileIndex> files;
+
+    // true if something below can't have a twin (a file without duplicate)
+    bool unique = false;
+    HashValue digest = 0;
+    FileSize bytes = 0;
+    FileSize allocated = 0;
+    size_t fileCount = 0;
+
+    // identical directory group this node belongs to, NO_NODE if none
+    size_t group = NO_NODE;
+};
+
+// one child of a directory in its digest
+struct Entry {
+    std::string name;
+    char type;
+    FileSize size;
+    HashValue hash;
+};
+
+class Tree {
+public:
+    Tree(const std::vector<FilePath>& roots) {
+        for(const auto& root: roots) {
+            rootPaths.insert(root.native());
+        }
+    }
+
+    // node of a directory, creating it and its ancestors up to a root
+    size_t node(const FilePath& path) {
+        auto [it, inserted] = index.emplace(path.native(), nodes.size());
+        if(!inserted) {
+            return it->second;
+        }
+
+        size_t id = nodes.size();
+        nodes.push_back({});
+        nodes[id].path = path;
+
+        FilePath parentPath = path.parent_path();
+        if(!rootPaths.count(path.native()) && parentPath != path && !parentPath.empty()) {
+            size_t parent = node(parentPath);
+            nodes[id].parent = parent;
+            nodes[parent].children.push_back(id);
+        }
+        return id;
+    }
+
+    // children before parents
+    std::vector<size_t> postOrder() const {
+        std::vector<size_t> order;
+        order.reserve(nodes.size());
+
+        std::vector<std::pair<size_t, size_t>> stack;
+        for(size_t id=0; id<nodes.size(); id++) {
+            if(nodes[id].parent != NO_NODE) continue;
+
+            stack.push_back({id, 0});
+            while(!stack.empty()) {
+                auto& [current, next] = stack.back();
+                if(next < nodes[current].children.size()) {
+                    size_t child = nodes[current].children[next++];
+                    stack.push_back({child, 0});
+                } else {
+                    order.push_back(current);
+                    stack.pop_back();
+                }
+            }
+        }
+        return order;
+    }
+
+    std::vector<Node> nodes;
+
+private:
+    std::unordered_set<std::string> rootPaths;
+    std::unordered_map<std::string, size_t> index;
+};
+
+HashValue digestEntries(std::vector<Entry>& entries) {
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.name < b.name;
+    });
+
+    XXH64_state_t* state = XXH64_createState();
+    XXH64_reset(state, XXHASH_SEED);
+
+    for(const Entry& entry: entries) {
+        XXH64_canonical_t fields[3];
+        XXH64_canonicalFromHash(&fields[0], entry.name.size());
+        XXH64_canonicalFromHash(&fields[1], entry.size);
+        XXH64_canonicalFromHash(&fields[2], entry.hash);
+
+        XXH64_update(state, &entry.type, 1);
+        XXH64_update(state, &fields[0], sizeof(fields[0]));
+        XXH64_update(state, entry.name.data(), entry.name.size());
+        XXH64_update(state, &fields[1], sizeof(fields[1]) * 2);
+    }
+
+    HashValue digest = XXH64_digest(state);
+    XXH64_freeState(state);
+    return digest;
+}
+
+}
+
+/*
+    one pass over the files builds the directory tree, one post-order pass
+    hashes it. a directory holding any file without a duplicate (or below
+    such a directory) gets no digest at all, so only directories made up
+    entirely of duplicates are compared
+*/
+DirectoryHashing::Result DirectoryHashing::collapse(
+    const FileList& files,
+    const FileGroups& hashGroups,
+    const std::vector<FilePath>& roots,
+    const std::vector<FilePath>& uniqueDirectories
+) {
+    // content hash of every file that has a duplicate
+    std::vector<std::optional<HashValue>> contentHash(files.size());
+    for(size_t g=0; g<hashGroups.count(); g++) {
+        if(hashGroups.size(g) < 2) continue;
+        for(const KeyedFile* record = hashGroups.begin(g); record != hashGroups.end(g); record++) {
+            contentHash[record->file] = record->key;
+        }
+    }
+
+    Tree tree(roots);
+    std::vector<size_t> parentOf(files.size());
+    for(size_t i=0; i<files.size(); i++) {
+        parentOf[i] = tree.node(files[i].path.parent_path());
+        Node& parent = tree.nodes[parentOf[i]];
+        if(contentHash[i]) {
+            parent.files.push_back(i);
+        } else {
+            parent.unique = true;
+        }
+    }
+
+    for(const auto& directory: uniqueDirectories) {
+        tree.nodes[tree.node(directory)].unique = true;
+    }
+
+    // step 1: digests bottom-up
+    std::vector<Node>& nodes = tree.nodes;
+    std::vector<Entry> entries;
+    for(size_t id: tree.postOrder()) {
+        Node& node = nodes[id];
+        if(node.parent != NO_NODE && node.unique) {
+            nodes[node.parent].unique = true;
+        }
+        if(node.unique) continue;
+
+        entries.clear();
+        for(FileIndex file: node.files) {
+            entries.push_back({files[file].path.filename().string(), 'F', files[file].size, *contentHash[file]});
+            node.bytes += files[file].size;
+            node.allocated += files[file].allocated;
+            node.fileCount++;
+        }
+        for(size_t child: node.children) {
+            const Node& sub = nodes[child];
+            entries.push_back({sub.path.filename().string(), 'D', sub.bytes, sub.digest});
+            node.bytes += sub.bytes;
+            node.allocated += sub.allocated;
+            node.fileCount += sub.fileCount;
+        }
+        node.digest = digestEntries(entries);
+    }
+
+    // step 2: group directories by digest
+    std::unordered_map<HashValue, std::vector<size_t>> byDigest;
+    for(size_t id=0; id<nodes.size(); id++) {
+        if(!nodes[id].unique && nodes[id].fileCount > 0) {
+            byDigest[nodes[id].digest].push_back(id);
+        }
+    }
+
+    std::vector<std::vector<size_t>> groups;
+    for(auto& [digest, members]: byDigest) {
+        if(members.size() < 2) continue;
+        for(size_t id: members) {
+            nodes[id].group = groups.size();
+        }
+        groups.push_back(std::move(members));
+    }
+
+    // first copy by path of every group, the one whose contents get reported
+    std::vector<size_t> firstCopy(groups.size());
+    for(size_t g=0; g<groups.size(); g++) {
+        firstCopy[g] = *std::min_element(groups[g].begin(), groups[g].end(), [&nodes](size_t a, size_t b) {
+            return nodes[a].path < nodes[b].path;
+        });
+    }
+
+    /*
+        which members of a group to report, given the directory each one
+        lies in (aligned with the members). when all of those are copies of
+        one identical directory, that directory's report covers the group,
+        unless a copy holds two or more members: those are duplicates inside
+        the copy itself, reported once from its first copy. copies spread
+        over different groups (P1=Q1, P2=Q2, x in all four) are all reported
+    */
+    auto reported = [&](const std::vector<size_t>& parents) {
+        std::vector<char> keep(parents.size(), 1);
+
+        size_t first = parents.front();
+        if(first == NO_NODE || nodes[first].group == NO_NODE) {
+            return keep;
+        }
+        size_t g = nodes[first].group;
+        bool covered = std::all_of(parents.begin(), parents.end(), [&](size_t parent) {
+            return parent != NO_NODE && nodes[parent].group == g;
+        });
+        if(!covered) {
+            return keep;
+        }
+
+        size_t inFirstCopy = std::count(parents.begin(), parents.end(), firstCopy[g]);
+        for(size_t i=0; i<parents.size(); i++) {
+            keep[i] = inFirstCopy > 1 && parents[i] == firstCopy[g];
+        }
+        return keep;
+    };
+
+    // step 3: directory groups
+    Result result;
+    std::vector<size_t> parents;
+    for(auto& members: groups) {
+        parents.clear();
+        for(size_t id: members) {
+            parents.push_back(nodes[id].parent);
+        }
+        std::vector<char> keep = reported(parents);
+
+        std::vector<size_t> kept;
+        for(size_t i=0; i<members.size(); i++) {
+            if(keep[i]) kept.push_back(members[i]);
+        }
+        if(kept.size() < 2) continue;
+
+        DuplicateGroup group;
+        group.directory = true;
+        group.hash = Hashing::toHex(nodes[kept.front()].digest);
+        group.fileSize = nodes[kept.front()].bytes;
+        group.fileCount = nodes[kept.front()].fileCount;
+        std::sort(kept.begin(), kept.end(), [&nodes](size_t a, size_t b) {
+            return nodes[a].path < nodes[b].path;
+        });
+        for(size_t id: kept) {
+            group.files.push_back(nodes[id].path);
+            group.allocatedSizes.push_back(nodes[id].allocated);
+        }
+        result.directories.push_back(std::move(group));
+    }
+
+    // step 4: file groups, the same way
+    for(size_t g=0; g<hashGroups.count(); g++) {
+        if(hashGroups.size(g) < 2) continue;
+
+        parents.clear();
+        for(const KeyedFile* record = hashGroups.begin(g); record != hashGroups.end(g); record++) {
+            parents.push_back(parentOf[record->file]);
+        }
+        std::vector<char> keep = reported(parents);
+        if(std::count(keep.begin(), keep.end(), 1) < 2) continue;
+
+        for(size_t i=0; i<parents.size(); i++) {
+            if(keep[i]) result.files.records.push_back(hashGroups.begin(g)[i]);
+        }
+        result.files.bounds.push_back(result.files.records.size());
+    }
+
+    return result;
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "dupesweep/types.h"
+#include <vector>
+
+namespace dupesweep {
+    /*
+        finds identical directory trees from the file digests alone.
+        a directory's digest covers the names, sizes and content hashes of
+        its files and the names and digests of its subdirectories, so it is
+        built bottom-up without reading any file again
+    */
+    class DirectoryHashing {
+    public:
+        struct Result {
+            DuplicateList directories;  // largest identical subtrees
+            FileGroups files;           // file groups not inside them
+        };
+
+        // files and hashGroups as left by Hashing::findDuplicates,
+        // uniqueDirectories holds directories known to contain a file
+        // without any duplicate (those files are no longer in files) or an
+        // entry the traversal left out, so only fully scanned trees match
+        static Result collapse(
+            const FileList& files,
+            const FileGroups& hashGroups,
+            const std::vector<FilePath>& roots,
+            const std::vector<FilePath>& uniqueDirectories
+        );
+    };
+}
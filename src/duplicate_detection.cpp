@@ -1,64 +1,763 @@
 #include "duplicate_detection.h"
+#include "content_index.h"
+#include "directory_hashing.h"
 #include "file_traversal.h"
 #include "grouping.h"
 #include "hashing.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <sys/stat.h>
 
 namespace dupesweep {
 
+namespace {
+
+// device and inode of a regular file that still has the given size
+std::optional<std::pair<dev_t, ino_t>> fileIdentity(const char* path, FileSize size) {
+    struct stat st;
+    if(::lstat(path, &st) != 0 || !S_ISREG(st.st_mode) || static_cast<FileSize>(st.st_size) != size) {
+        return std::nullopt;
+    }
+    return std::make_pair(st.st_dev, st.st_ino);
+}
+
+// a failed save only costs the progress since the last one, the scan goes on
+void saveCheckpoint(Checkpoint& checkpoint, const Checkpoint::State& state) {
+    try {
+        checkpoint.save(state);
+    } catch(const std::exception& e) {
+        std::cerr << "error writing checkpoint: " << e.what() << "\n";
+    }
+}
+
+}
+
 DuplicateList DuplicateDetection::findDuplicates(
     const FilePath& directory,
     int numThreads,
     const std::function<void(const std::string&, int, int)>& progressCallback
 ) {
-    // step 1: collect all files
-    progressCallback("scanning directory... ", 0, 0);
-    FileList files = FileTraversal::collectFiles(
-        directory,
-        [&progressCallback](const FilePath& path) {
-            progressCallback("scanning: " + path.filename().string(), 0, 0);
-        }
-    );
+    FileTraversal::Options traversalOptions;
+    traversalOptions.roots.push_back(directory);
+
+    Hashing::Options hashingOptions;
+    hashingOptions.numThreads = numThreads;
+
+    return findDuplicates(traversalOptions, hashingOptions, {}, {}, progressCallback);
+}
+
+DuplicateList DuplicateDetection::findDuplicates(
+    const FileTraversal::Options& traversalOptions,
+    const Hashing::Options& hashingOptions,
+    const Checkpoint::Options& checkpointOptions,
+    const Options& options,
+    const std::function<void(const std::string&, int, int)>& progressCallback,
+    Stats* stats
+) {
+    Stats localStats;
+    Stats& result = stats != nullptr ? *stats : localStats;
+    result = Stats();
+
+    Checkpoint checkpoint(checkpointOptions);
+    Checkpoint::State state;
+
+    // canonical, so "ck" and "/tmp/ck" are the same scan
+    std::vector<FilePath> roots = FileTraversal::initialFrontier(traversalOptions).directories;
+
+    if(checkpointOptions.resume) {
+        state = Checkpoint::load(checkpointOptions.path);
+        resumeState(state, roots, hashingOptions, progressCallback);
+    } else {
+        state.frontier = roots;
+    }
+
+    state.roots = roots;
+    state.smallFileBytes = hashingOptions.smallFileBytes;
+    state.treeHashBytes = hashingOptions.treeHashBytes;
+    state.segmentBytes = hashingOptions.segmentBytes;
+
+    // step 1: collect all files (or the rest of them)
+    FileList files;
+    if(state.traversalDone) {
+        files = std::move(state.files);
+    } else {
+        progressCallback("scanning directory... ", 0, 0);
+
+        // directories the walk did not fully collect can't have an identical twin
+        FileTraversal::Frontier start{std::move(state.frontier), std::move(state.files), std::move(state.uniqueDirectories)};
+        files = FileTraversal::collectFiles(
+            traversalOptions,
+            [&progressCallback](const FilePath& path) {
+                progressCallback("scanning: " + path.filename().string(), 0, 0);
+            },
+            std::move(start),
+            [&checkpoint] { return checkpoint.due(); },
+            [&checkpoint, &state](FileTraversal::Frontier frontier) {
+                state.frontier = std::move(frontier.directories);
+                state.files = std::move(frontier.files);
+                state.uniqueDirectories = std::move(frontier.incomplete);
+                saveCheckpoint(checkpoint, state);
+                state.files.clear();
+            },
+            state.uniqueDirectories
+        );
+
+        state.frontier.clear();
+        state.quickHashes.clear();
+        state.fullHashes.clear();
+    }
 
     progressCallback("found " + std::to_string(files.size()) + " files", 0, 0);
     if(files.empty()) {
+        checkpoint.remove();
         return {};
     }
 
     // step 2: groups files by size
     progressCallback("grouping files by size...", 0 , 0);
-    SizeGroup sizeGroups = Grouping::groupFilesBySize(files);
-    SizeGroup potentialDuplicates = Grouping::filterPotentialDuplicates(sizeGroups);
+    FileGroups sizeGroups = Grouping::groupFilesBySize(files, hashingOptions.numThreads);
+    Grouping::filterPotentialDuplicates(sizeGroups);
+
+    // only the candidates matter from here on, which also keeps the
+    // checkpoint small
+    keepCandidates(files, sizeGroups, state.uniqueDirectories, state.quickHashes, state.fullHashes);
 
     // count files with potential duplicates
-    int potentialDuplicatesCount = 0;
-    for(const auto& [size, paths]: potentialDuplicates) {
-        potentialDuplicatesCount += paths.size();
-    }
+    int potentialDuplicatesCount = sizeGroups.records.size();
 
     progressCallback("found " + std::to_string(potentialDuplicatesCount) + " potential duplicates", 0, 0);
 
     if(potentialDuplicatesCount == 0){
+        checkpoint.remove();
         return {};
     }
 
+    // fit the probes and the read settings to this data and hardware
+    Hashing::Options tunedOptions = hashingOptions;
+    Hashing::Options savedOptions = hashingOptions;
+    savedOptions.probe = {state.probeBytes, static_cast<Hashing::ProbeLocation>(state.probeLocation)};
+    for(const auto& [bucket, probe]: state.bucketProbes) {
+        savedOptions.probes[bucket] = {probe.first, static_cast<Hashing::ProbeLocation>(probe.second)};
+    }
+
+    if(options.adaptive) {
+        progressCallback("tuning hashing parameters...", 0, 0);
+        result.tuning.enabled = true;
+
+        if(state.probeBytes != 0) {
+            // keep the probes of the interrupted run, their quick hashes stay valid
+            tunedOptions.probe = savedOptions.probe;
+            tunedOptions.probes = savedOptions.probes;
+            for(const auto& [bucket, probe]: tunedOptions.probes) {
+                result.tuning.buckets.push_back({bucket, probe});
+            }
+            result.tuning.probeReused = true;
+        } else {
+            tunedOptions.probes = Tuning::chooseProbes(files, sizeGroups, hashingOptions, result.tuning);
+        }
+        Tuning::probeDevices(files, sizeGroups, tunedOptions, result.tuning);
+    }
+
+    // quick hashes of larger files are only comparable under one probe
+    if(state.probeBytes != 0) {
+        for(size_t i=0; i<files.size(); i++) {
+            FileSize size = files[i].size;
+            if(!Hashing::isSmallFile(size, tunedOptions) &&
+               !(Hashing::probeFor(size, savedOptions) == Hashing::probeFor(size, tunedOptions))) {
+                state.quickHashes[i].reset();
+            }
+        }
+    }
+    state.probeBytes = tunedOptions.probe.bytes;
+    state.probeLocation = static_cast<uint8_t>(tunedOptions.probe.location);
+    state.bucketProbes.clear();
+    for(const auto& [bucket, probe]: tunedOptions.probes) {
+        state.bucketProbes[bucket] = {probe.bytes, static_cast<uint8_t>(probe.location)};
+    }
+
+    // the cache only exists to feed checkpoints, without them the stages
+    // store their digests directly
+    std::optional<Hashing::Cache> cache;
+    if(checkpoint.enabled()) {
+        cache.emplace(std::move(state.quickHashes), std::move(state.fullHashes));
+
+        state.traversalDone = true;
+        state.files = files;
+        cache->snapshot(state.quickHashes, state.fullHashes);
+        saveCheckpoint(checkpoint, state);
+    }
+    Hashing::Cache* hashCache = cache ? &*cache : nullptr;
+
+    // save the hashes computed so far every interval while hashing runs
+    std::mutex saverMutex;
+    std::condition_variable saverWake;
+    bool hashingDone = false;
+    std::thread saver;
+    if(checkpoint.enabled()) {
+        saver = std::thread([&] {
+            std::unique_lock<std::mutex> lock(saverMutex);
+            while(!hashingDone) {
+                saverWake.wait_for(lock, std::chrono::seconds(1));
+                if(hashingDone || !checkpoint.due()) continue;
+
+                cache->snapshot(state.quickHashes, state.fullHashes);
+                saveCheckpoint(checkpoint, state);
+            }
+        });
+    }
+
+    auto stopSaver = [&] {
+        if(!saver.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(saverMutex);
+            hashingDone = true;
+        }
+        saverWake.notify_all();
+        saver.join();
+    };
+
     // step 3: find duplicates using quickHash + fullHash
     progressCallback("calculating file hashes...", 0, potentialDuplicatesCount);
-    HashGroup duplicateHashGroups = Hashing::findDuplicates(
-        potentialDuplicates,
-        numThreads,
-        [&progressCallback](int processed, int total) {
-            progressCallback("hashing files... ", processed, total);
+    FileGroups duplicateHashGroups;
+    DuplicateList streamed;
+    try {
+        if(options.anytime) {
+            streamed = findDuplicatesAnytime(files, std::move(sizeGroups), tunedOptions, options, hashCache, progressCallback, result);
+        } else {
+            duplicateHashGroups = Hashing::findDuplicates(
+                files,
+                std::move(sizeGroups),
+                tunedOptions,
+                [&progressCallback](int processed, int total) {
+                    progressCallback("hashing files... ", processed, total);
+                },
+                hashCache,
+                &result.bytesRead
+            );
         }
-    );
+    } catch(...) {
+        stopSaver();
+        throw;
+    }
+    stopSaver();
+
+    if(result.complete) {
+        // the scan is complete, nothing left to resume
+        checkpoint.remove();
+    } else if(checkpoint.enabled()) {
+        // a stopped anytime scan can be resumed with what it hashed so far
+        cache->snapshot(state.quickHashes, state.fullHashes);
+        saveCheckpoint(checkpoint, state);
+    }
+
+    // anytime results were handed out as they were confirmed
+    if(options.anytime) {
+        progressCallback("found " + std::to_string(streamed.size()) + " duplicate groups", 0, 0);
+        return streamed;
+    }
+
+    // step 4: optionally fold whole identical trees into one entry each
+    DuplicateList duplicates;
+    if(options.directories) {
+        progressCallback("hashing directories...", 0, 0);
+        DirectoryHashing::Result collapsed = DirectoryHashing::collapse(
+            files,
+            duplicateHashGroups,
+            roots,
+            state.uniqueDirectories
+        );
+        progressCallback("found " + std::to_string(collapsed.directories.size()) + " duplicate directories", 0, 0);
+
+        duplicates = std::move(collapsed.directories);
+        duplicateHashGroups = std::move(collapsed.files);
+    }
+
+    // step 5: convert to duplicate list
+    DuplicateList fileDuplicates = hashGroupToDuplicateList(files, duplicateHashGroups, hashingOptions.numThreads);
+    progressCallback("found " + std::to_string(fileDuplicates.size()) + " duplicate groups", 0, 0);
+
+    duplicates.insert(duplicates.end(),
+                      std::make_move_iterator(fileDuplicates.begin()),
+                      std::make_move_iterator(fileDuplicates.end()));
+    sortDuplicates(duplicates, hashingOptions.numThreads);
+    return duplicates;
+}
+
+/*
+    size groups are taken in order of the most space they could free and
+    hashed in batches, so the first batches find the biggest wins and a
+    batch is large enough to keep all workers busy. every batch runs the
+    normal quick/full pipeline, so each reported group is fully confirmed.
+    the limits are checked before every hashing job, so a scan stops within
+    one job per worker of its time or byte budget. a size group the stop
+    cut through is dropped as a whole and counts as unexamined, like the
+    groups too large for what was left of the byte budget
+*/
+DuplicateList DuplicateDetection::findDuplicatesAnytime(
+    FileList& files,
+    FileGroups sizeGroups,
+    const Hashing::Options& hashingOptions,
+    const Options& options,
+    Hashing::Cache* cache,
+    const std::function<void(const std::string&, int, int)>& progressCallback,
+    Stats& stats
+) {
+    auto start = std::chrono::steady_clock::now();
+
+    auto potentialWaste = [&](size_t g) {
+        return static_cast<FileSize>(sizeGroups.begin(g)->key) * (sizeGroups.size(g) - 1);
+    };
+
+    std::vector<size_t> order(sizeGroups.count());
+    for(size_t g=0; g<order.size(); g++) {
+        order[g] = g;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return potentialWaste(a) > potentialWaste(b);
+    });
+
+    Hashing::Budget budget([&](FileSize started) {
+        if(options.timeLimitSeconds > 0 &&
+           std::chrono::steady_clock::now() - start >= std::chrono::seconds(options.timeLimitSeconds)) {
+            return true;
+        }
+        return options.byteBudget > 0 && started >= options.byteBudget;
+    });
+
+    int totalFiles = sizeGroups.records.size();
+    int doneFiles = 0;
+    DuplicateList duplicates;
+    std::vector<size_t> unfinished;
+    size_t next = 0;
+
+    while(next < order.size() && !budget.spent()) {
+        // batches shrink to what is left of a byte budget, and a group that
+        // could not be read whole within it is passed over for smaller ones
+        // instead of being cut halfway
+        FileSize remaining = options.byteBudget > 0 ? options.byteBudget - budget.bytesStarted() : 0;
+        FileSize batchLimit = ANYTIME_BATCH_BYTES;
+        if(options.byteBudget > 0) {
+            batchLimit = std::min(batchLimit, remaining);
+        }
+
+        FileGroups batch;
+        std::vector<size_t> batchGroups;
+        FileSize batchBytes = 0;
+        while(next < order.size() &&
+              (batch.count() == 0 || (batchBytes < batchLimit && batch.records.size() < ANYTIME_BATCH_FILES))) {
+            size_t g = order[next++];
+            FileSize groupBytes = static_cast<FileSize>(sizeGroups.begin(g)->key) * sizeGroups.size(g);
+            if(options.byteBudget > 0 && groupBytes > remaining - batchBytes) {
+                unfinished.push_back(g);
+                continue;
+            }
+
+            batch.records.insert(batch.records.end(), sizeGroups.begin(g), sizeGroups.end(g));
+            batch.bounds.push_back(batch.records.size());
+            batchGroups.push_back(g);
+            batchBytes += groupBytes;
+        }
+        if(batch.count() == 0) {
+            break;
+        }
+
+        int batchFiles = batch.records.size();
+        FileGroups confirmed = Hashing::findDuplicates(
+            files,
+            std::move(batch),
+            hashingOptions,
+            [&](int processed, int) {
+                if(processed > 0) {
+                    progressCallback("hashing files... ", doneFiles + processed, totalFiles);
+                }
+            },
+            cache,
+            nullptr,
+            &budget
+        );
+        doneFiles += batchFiles;
+
+        // drop the confirmed groups of size groups with a skipped file,
+        // their other members may still have copies nobody looked at
+        std::vector<FileIndex> skipped = budget.takeSkipped();
+        if(!skipped.empty()) {
+            std::unordered_set<FileIndex> skippedFiles(skipped.begin(), skipped.end());
+            std::unordered_set<FileIndex> dropped;
+            for(size_t g: batchGroups) {
+                bool cut = std::any_of(sizeGroups.begin(g), sizeGroups.end(g), [&](const KeyedFile& record) {
+                    return skippedFiles.count(record.file) > 0;
+                });
+                if(!cut) continue;
+
+                unfinished.push_back(g);
+                for(const KeyedFile* record = sizeGroups.begin(g); record != sizeGroups.end(g); record++) {
+                    dropped.insert(record->file);
+                }
+            }
+
+            // a confirmed group never spans two size groups
+            FileGroups kept;
+            for(size_t g=0; g<confirmed.count(); g++) {
+                if(dropped.count(confirmed.begin(g)->file)) continue;
+                kept.records.insert(kept.records.end(), confirmed.begin(g), confirmed.end(g));
+                kept.bounds.push_back(kept.records.size());
+            }
+            confirmed = std::move(kept);
+        }
+
+        DuplicateList found = hashGroupToDuplicateList(files, confirmed, hashingOptions.numThreads);
+        sortDuplicates(found, hashingOptions.numThreads);
+
+        for(auto& group: found) {
+            if(options.onGroup) {
+                options.onGroup(group);
+            }
+            duplicates.push_back(std::move(group));
+        }
+    }
+
+    stats.bytesRead = budget.bytesStarted();
 
-    // step 4: convert to duplicate list
-    DuplicateList duplicates = hashGroupToDuplicateList(duplicateHashGroups, sizeGroups);
-    progressCallback("found " + std::to_string(duplicates.size()) + " duplicate groups", 0, 0);
+    // whatever is left was never looked at or only in part
+    for(; next < order.size(); next++) {
+        unfinished.push_back(order[next]);
+    }
+    stats.complete = unfinished.empty();
+    for(size_t g: unfinished) {
+        stats.unexaminedGroups++;
+        stats.unexaminedFiles += sizeGroups.size(g);
+        stats.unexaminedWaste += potentialWaste(g);
+    }
 
     return duplicates;
 }
 
+/*
+    a checkpoint is only trusted as far as the files still look the same:
+    files that are gone are dropped, files whose size or mtime changed keep
+    their place but lose their hashes
+*/
+void DuplicateDetection::resumeState(
+    Checkpoint::State& state,
+    const std::vector<FilePath>& roots,
+    const Hashing::Options& hashingOptions,
+    const std::function<void(const std::string&, int, int)>& progressCallback
+) {
+    if(state.roots != roots) {
+        throw std::runtime_error("checkpoint was written for different directories");
+    }
+
+    // digests made with other thresholds are not comparable
+    if(state.smallFileBytes != hashingOptions.smallFileBytes ||
+       state.treeHashBytes != hashingOptions.treeHashBytes ||
+       state.segmentBytes != hashingOptions.segmentBytes) {
+        progressCallback("hashing options changed, discarding saved hashes", 0, 0);
+        std::fill(state.quickHashes.begin(), state.quickHashes.end(), std::nullopt);
+        std::fill(state.fullHashes.begin(), state.fullHashes.end(), std::nullopt);
+    }
+
+    progressCallback("checking " + std::to_string(state.files.size()) + " files from the checkpoint...", 0, 0);
+
+    std::vector<char> keep(state.files.size());
+    Scheduler::parallelFor(state.files.size(), hashingOptions.numThreads, [&](size_t i) {
+        FileInfo& file = state.files[i];
+        FileSize size = file.size;
+        int64_t modified = file.modified;
+
+        keep[i] = FileTraversal::revalidate(file);
+        if(keep[i] && (file.size != size || file.modified != modified)) {
+            state.quickHashes[i].reset();
+            state.fullHashes[i].reset();
+        }
+    });
+
+    size_t out = 0;
+    size_t hashed = 0;
+    for(size_t i=0; i<state.files.size(); i++) {
+        if(!keep[i]) continue;
+        if(state.fullHashes[i]) hashed++;
+
+        state.files[out] = std::move(state.files[i]);
+        state.quickHashes[out] = state.quickHashes[i];
+        state.fullHashes[out] = state.fullHashes[i];
+        out++;
+    }
+    state.files.resize(out);
+    state.quickHashes.resize(out);
+    state.fullHashes.resize(out);
+
+    progressCallback("resuming with " + std::to_string(out) + " files, " + std::to_string(hashed) + " already hashed", 0, 0);
+}
+
+/*
+    shrink files (and the hashes aligned with it) to the files that are in
+    size groups and point the group records at the new indices
+*/
+void DuplicateDetection::keepCandidates(
+    FileList& files,
+    FileGroups& sizeGroups,
+    std::vector<FilePath>& uniqueDirectories,
+    std::vector<std::optional<HashValue>>& quickHashes,
+    std::vector<std::optional<HashValue>>& fullHashes
+) {
+    bool haveHashes = quickHashes.size() == files.size();
+
+    // a directory with a file of unique size can't have an identical twin,
+    // the directory stage needs to know that after the file is gone
+    std::vector<char> candidate(files.size());
+    for(const KeyedFile& record: sizeGroups.records) {
+        candidate[record.file] = 1;
+    }
+
+    std::unordered_set<std::string> seen;
+    for(const auto& directory: uniqueDirectories) {
+        seen.insert(directory.native());
+    }
+    for(size_t i=0; i<files.size(); i++) {
+        if(candidate[i]) continue;
+
+        FilePath directory = files[i].path.parent_path();
+        if(seen.insert(directory.native()).second) {
+            uniqueDirectories.push_back(std::move(directory));
+        }
+    }
+
+    FileList candidates;
+    std::vector<std::optional<HashValue>> candidateQuick;
+    std::vector<std::optional<HashValue>> candidateFull;
+    candidates.reserve(sizeGroups.records.size());
+
+    for(KeyedFile& record: sizeGroups.records) {
+        if(haveHashes) {
+            candidateQuick.push_back(quickHashes[record.file]);
+            candidateFull.push_back(fullHashes[record.file]);
+        }
+        candidates.push_back(std::move(files[record.file]));
+        record.file = candidates.size() - 1;
+    }
+
+    files = std::move(candidates);
+    quickHashes = std::move(candidateQuick);
+    fullHashes = std::move(candidateFull);
+    quickHashes.resize(files.size());
+    fullHashes.resize(files.size());
+}
+
+size_t DuplicateDetection::buildIndex(
+    const FileTraversal::Options& traversalOptions,
+    const FilePath& indexPath,
+    const Hashing::Options& hashingOptions,
+    const std::function<void(const std::string&, int, int)>& progressCallback
+) {
+    // step 1: collect all files
+    progressCallback("scanning directory... ", 0, 0);
+    FileList files = FileTraversal::collectFiles(
+        traversalOptions,
+        [&progressCallback](const FilePath& path) {
+            progressCallback("scanning: " + path.filename().string(), 0, 0);
+        }
+    );
+    progressCallback("found " + std::to_string(files.size()) + " files", 0, 0);
+
+    std::vector<KeyedFile> all(files.size());
+    for(size_t i=0; i<files.size(); i++) {
+        all[i] = {files[i].size, i};
+    }
+
+    // step 2: every file needs both hashes, queries compare against them
+    // without touching the indexed tree again
+    int total = all.size();
+    std::atomic<int> processed(0);
+    std::mutex progressMutex;
+
+    progressCallback("calculating quick hashes...", 0, total);
+    std::vector<std::optional<HashValue>> quickHashes = Hashing::quickHashAll(files, all, hashingOptions);
+
+    std::vector<KeyedFile> quickHashed;
+    for(size_t i=0; i<files.size(); i++) {
+        if(quickHashes[i]) {
+            quickHashed.push_back({*quickHashes[i], i});
+        }
+    }
+    processed += files.size() - quickHashed.size();
+
+    progressCallback("calculating file hashes...", 0, total);
+    std::vector<std::optional<HashValue>> fullHashes = Hashing::finalHashes(files, quickHashed, hashingOptions, [&](size_t count) {
+        int done = processed += count;
+        std::lock_guard<std::mutex> lock(progressMutex);
+        progressCallback("hashing files... ", done, total);
+    });
+
+    // step 3: write the index
+    std::vector<ContentIndex::Record> records;
+    records.reserve(quickHashed.size());
+    for(size_t h=0; h<quickHashed.size(); h++) {
+        if(!fullHashes[h]) continue;
+        FileInfo& file = files[quickHashed[h].file];
+        records.push_back({std::move(file.path), file.size, quickHashed[h].key, *fullHashes[h]});
+    }
+
+    size_t indexed = records.size();
+    progressCallback("writing index " + indexPath.string(), 0, 0);
+    ContentIndex::Scheme scheme{hashingOptions.smallFileBytes, hashingOptions.treeHashBytes, hashingOptions.segmentBytes};
+    ContentIndex::save(indexPath, std::move(records), scheme);
+
+    return indexed;
+}
+
+/*
+    only the new tree is scanned. a file is quick hashed only if its size
+    occurs in the index, and fully hashed only if (size, quick hash) does,
+    so the cost follows the new data and not the indexed archive
+*/
+DuplicateList DuplicateDetection::queryIndex(
+    const FileTraversal::Options& traversalOptions,
+    const FilePath& indexPath,
+    const Hashing::Options& hashingOptions,
+    const std::function<void(const std::string&, int, int)>& progressCallback
+) {
+    ContentIndex index = ContentIndex::open(indexPath);
+    progressCallback("loaded index with " + std::to_string(index.size()) + " files", 0, 0);
+
+    // digests must be computed the way the index was built
+    Hashing::Options options = hashingOptions;
+    options.smallFileBytes = index.scheme().smallFileBytes;
+    options.treeHashBytes = index.scheme().treeHashBytes;
+    options.segmentBytes = index.scheme().segmentBytes;
+
+    // step 1: collect the new files
+    progressCallback("scanning directory... ", 0, 0);
+    FileList files = FileTraversal::collectFiles(
+        traversalOptions,
+        [&progressCallback](const FilePath& path) {
+            progressCallback("scanning: " + path.filename().string(), 0, 0);
+        }
+    );
+    progressCallback("found " + std::to_string(files.size()) + " files", 0, 0);
+
+    // step 2: keep files whose size is in the index
+    std::vector<KeyedFile> sized;
+    for(size_t i=0; i<files.size(); i++) {
+        auto [first, last] = index.findSize(files[i].size);
+        if(first != last) {
+            sized.push_back({files[i].size, i});
+        }
+    }
+
+    progressCallback("found " + std::to_string(sized.size()) + " files with a size in the index", 0, 0);
+    if(sized.empty()) {
+        return {};
+    }
+
+    // step 3: quick hash them and keep the (size, quick hash) hits
+    std::vector<std::optional<HashValue>> quickHashes = Hashing::quickHashAll(files, sized, options);
+
+    std::vector<KeyedFile> candidates;
+    for(size_t r=0; r<sized.size(); r++) {
+        if(!quickHashes[r]) continue;
+
+        auto [first, last] = index.find(sized[r].key, *quickHashes[r]);
+        if(first != last) {
+            candidates.push_back({*quickHashes[r], sized[r].file});
+        }
+    }
+
+    progressCallback("found " + std::to_string(candidates.size()) + " potential matches", 0, 0);
+
+    // step 4: full hash the candidates and look for an identical indexed file
+    int total = candidates.size();
+    std::atomic<int> processed(0);
+    std::mutex progressMutex;
+
+    // small files were finished by their single read
+    std::vector<std::optional<HashValue>> fullHashes = Hashing::finalHashes(files, candidates, options, [&](size_t count) {
+        int done = processed += count;
+        std::lock_guard<std::mutex> lock(progressMutex);
+        progressCallback("hashing files... ", done, total);
+    });
+
+    /*
+        the index is only a record of the past: an indexed file counts once
+        lstat shows it still exists with its indexed size, and never when it
+        is one of the queried files (overlapping trees, hard links). with
+        x/f == y/f in both trees each would otherwise match the other, and
+        deleting the "copies" of both groups removes every one
+    */
+    std::vector<std::optional<std::pair<dev_t, ino_t>>> newFiles(candidates.size());
+    std::set<std::pair<dev_t, ino_t>> queried;
+    for(size_t r=0; r<candidates.size(); r++) {
+        if(!fullHashes[r]) continue;
+
+        const FileInfo& file = files[candidates[r].file];
+        newFiles[r] = fileIdentity(file.path.c_str(), file.size);
+        if(newFiles[r]) {
+            queried.insert(*newFiles[r]);
+        }
+    }
+
+    std::unordered_map<const ContentIndex::Entry*, std::optional<std::pair<dev_t, ino_t>>> indexedFiles;
+
+    DuplicateList matches;
+    std::unordered_map<const ContentIndex::Entry*, size_t> groupOf;
+
+    for(size_t r=0; r<candidates.size(); r++) {
+        if(!fullHashes[r] || !newFiles[r]) continue;
+
+        FilePath& path = files[candidates[r].file].path;
+        FileSize size = files[candidates[r].file].size;
+        HashValue fullHash = *fullHashes[r];
+
+        auto [first, last] = index.find(size, candidates[r].key);
+        const ContentIndex::Entry* match = nullptr;
+        for(const ContentIndex::Entry* entry = first; entry != last && match == nullptr; entry++) {
+            if(entry->fullHash != fullHash || path == index.path(*entry)) continue;
+
+            auto [known, inserted] = indexedFiles.try_emplace(entry);
+            if(inserted) {
+                known->second = fileIdentity(index.path(*entry), entry->size);
+            }
+            if(known->second && !queried.count(*known->second)) {
+                match = entry;
+            }
+        }
+        if(match == nullptr) continue;
+
+        auto [it, inserted] = groupOf.emplace(match, matches.size());
+        if(inserted) {
+            DuplicateGroup group;
+            group.hash = Hashing::toHex(fullHash);
+            group.fileSize = size;
+            group.files.push_back(index.path(*match));
+            group.allocatedSizes.push_back(size);
+            matches.push_back(std::move(group));
+        }
+
+        DuplicateGroup& group = matches[it->second];
+        group.allocatedSizes.push_back(files[candidates[r].file].allocated);
+        group.files.push_back(std::move(path));
+    }
+
+    // the indexed file stays first, its copies follow by path
+    for(auto& group: matches) {
+        sortMembers(group, 1);
+    }
+    sortDuplicates(matches, options.numThreads);
+
+    progressCallback("found " + std::to_string(matches.size()) + " indexed files with copies in the new data", 0, 0);
+
+    return matches;
+}
+
 FileSize DuplicateDetection::calculateWastedSpace(const DuplicateList& duplicates) {
     FileSize totalWasted = 0;
 
@@ -69,34 +768,82 @@ FileSize DuplicateDetection::calculateWastedSpace(const DuplicateList& duplicate
     return totalWasted;
 }
 
+/*
+    each group is built by one worker. paths are moved out of files, a file
+    is in one group at most, and sizes come from the traversal, so assembly
+    costs no syscalls at all
+*/
 DuplicateList DuplicateDetection::hashGroupToDuplicateList(
-    const HashGroup& hashGroup,
-    const SizeGroup& sizeGroups
+    FileList& files,
+    const FileGroups& hashGroups,
+    int numThreads
 ) {
-    DuplicateList duplicates;
+    std::vector<size_t> reported;
+    for(size_t g=0; g<hashGroups.count(); g++) {
+        if(hashGroups.size(g) > 1) {
+            reported.push_back(g);
+        }
+    }
 
-    for(const auto& [hash, paths]: hashGroup) {
-        if(paths.size() > 1) {
-            DuplicateGroup group;
-            group.hash = hash;
-            group.files = paths;
-
-            // find the file size
-            // get from the first file
-            if(!paths.empty()) {
-                try {
-                    group.fileSize = fs::file_size(paths[0]);
-                } catch(const fs::filesystem_error& e) {
-                    std::cerr << "error getting file size: " << e.what() << "\n";
-                    group.fileSize = 0;
-                }
-            }
+    DuplicateList duplicates(reported.size());
+    Scheduler::parallelFor(reported.size(), numThreads, [&](size_t d) {
+        size_t g = reported[d];
+        DuplicateGroup& group = duplicates[d];
+        group.hash = Hashing::toHex(hashGroups.begin(g)->key);
+
+        // all files in a group share the size found during traversal
+        group.fileSize = files[hashGroups.begin(g)->file].size;
 
-            duplicates.push_back(group);
+        group.files.reserve(hashGroups.size(g));
+        group.allocatedSizes.reserve(hashGroups.size(g));
+        for(const KeyedFile* record = hashGroups.begin(g); record != hashGroups.end(g); record++) {
+            FileInfo& file = files[record->file];
+            group.files.push_back(std::move(file.path));
+
+            // allocated blocks, for the real reclaimable space
+            group.allocatedSizes.push_back(file.allocated);
         }
-    }
+
+        sortMembers(group, 0);
+    });
 
     return duplicates;
 }
 
-}
\ No newline at end of file
+/*
+    biggest wasted space first, ties by first path. with the files inside
+    each group ordered by path this makes the output of repeated runs
+    identical
+*/
+void DuplicateDetection::sortDuplicates(DuplicateList& duplicates, int numThreads) {
+    Scheduler::parallelSort(duplicates, [](const DuplicateGroup& a, const DuplicateGroup& b) {
+        FileSize wastedA = a.wastedSpace();
+        FileSize wastedB = b.wastedSpace();
+        if(wastedA != wastedB) {
+            return wastedA > wastedB;
+        }
+        return a.files.front() < b.files.front();
+    }, numThreads);
+}
+
+// order files[from..] (and their allocated sizes) by path
+void DuplicateDetection::sortMembers(DuplicateGroup& group, size_t from) {
+    std::vector<size_t> order(group.files.size() - from);
+    for(size_t i=0; i<order.size(); i++) {
+        order[i] = from + i;
+    }
+    std::sort(order.begin(), order.end(), [&group](size_t a, size_t b) {
+        return group.files[a] < group.files[b];
+    });
+
+    std::vector<FilePath> files(group.files.begin(), group.files.begin() + from);
+    std::vector<FileSize> allocated(group.allocatedSizes.begin(), group.allocatedSizes.begin() + from);
+    for(size_t i: order) {
+        files.push_back(std::move(group.files[i]));
+        allocated.push_back(group.allocatedSizes[i]);
+    }
+    group.files = std::move(files);
+    group.allocatedSizes = std::move(allocated);
+}
+
+}
@@ -1,11 +1,47 @@
 #pragma once
 
 #include "dupesweep/types.h"
+#include "checkpoint.h"
+#include "file_traversal.h"
+#include "hashing.h"
+#include "tuning.h"
 #include <functional>
 
 namespace dupesweep {
     class DuplicateDetection {
     public:
+        struct Options {
+            // report identical directory trees as one entry each
+            // instead of the file groups inside them
+            bool directories = false;
+
+            // anytime mode: hash size groups by potential waste
+            // (size * (count - 1)), largest first, and hand every confirmed
+            // group to onGroup right away. a limit stops the scan early
+            bool anytime = false;
+            int timeLimitSeconds = 0;   // 0 = no limit
+            FileSize byteBudget = 0;    // bytes to hash, 0 = no limit
+            std::function<void(const DuplicateGroup&)> onGroup;
+
+            // choose the quick hash probe of each size bucket from a sample of its groups
+            // and read size / concurrency per device from timed reads
+            bool adaptive = false;
+        };
+
+        // what a scan left undone
+        struct Stats {
+            bool complete = true;
+            FileSize bytesRead = 0;
+
+            // size groups an anytime scan stopped before
+            size_t unexaminedGroups = 0;
+            size_t unexaminedFiles = 0;
+            FileSize unexaminedWaste = 0;   // upper bound, size * (count - 1)
+
+            // parameters picked in adaptive mode
+            Tuning::Report tuning;
+        };
+
         // find all duplicate files in the given directory
         static DuplicateList findDuplicates(
             const FilePath& directory,
@@ -13,10 +49,80 @@ namespace dupesweep {
             const std::function<void(const std::string&, int, int)>& progressCallback = [](const std::string&, int, int) {}
         );
 
+        // find all duplicate files under the configured roots.
+        // with a checkpoint path the scan state is saved periodically,
+        // and with resume set a previous run continues from that file
+        static DuplicateList findDuplicates(
+            const FileTraversal::Options& traversalOptions,
+            const Hashing::Options& hashingOptions,
+            const Checkpoint::Options& checkpointOptions,
+            const Options& options,
+            const std::function<void(const std::string&, int, int)>& progressCallback,
+            Stats* stats = nullptr
+        );
+
+        // scan the configured roots, hash every file and save a content index
+        // returns the number of indexed files
+        static size_t buildIndex(
+            const FileTraversal::Options& traversalOptions,
+            const FilePath& indexPath,
+            const Hashing::Options& hashingOptions,
+            const std::function<void(const std::string&, int, int)>& progressCallback = [](const std::string&, int, int) {}
+        );
+
+        // scan the configured roots and report the files that already exist
+        // in a saved index. each group lists the indexed file first,
+        // followed by the new files with the same content
+        static DuplicateList queryIndex(
+            const FileTraversal::Options& traversalOptions,
+            const FilePath& indexPath,
+            const Hashing::Options& hashingOptions,
+            const std::function<void(const std::string&, int, int)>& progressCallback = [](const std::string&, int, int) {}
+        );
+
         // calculate total wasted space from duplicate files
         static FileSize calculateWastedSpace(const DuplicateList& duplicates);
 
-        // convert HashGroup to DuplicateList
-        static DuplicateList hashGroupToDuplicateList(const HashGroup& hashGroup, const SizeGroup& sizeGroups);
+        // convert groups of identical files (keyed by full hash) to DuplicateList,
+        // moving the paths of the grouped files out of files
+        static DuplicateList hashGroupToDuplicateList(FileList& files, const FileGroups& hashGroups, int numThreads = 0);
+
+        // order groups by wasted space, largest first, then by first path
+        static void sortDuplicates(DuplicateList& duplicates, int numThreads = 0);
+
+    private:
+        // hash the size groups in batches, biggest potential waste first,
+        // until done or out of budget
+        static DuplicateList findDuplicatesAnytime(
+            FileList& files,
+            FileGroups sizeGroups,
+            const Hashing::Options& hashingOptions,
+            const Options& options,
+            Hashing::Cache* cache,
+            const std::function<void(const std::string&, int, int)>& progressCallback,
+            Stats& stats
+        );
+
+        // check a loaded checkpoint against the (normalized) roots,
+        // the options and the disk
+        static void resumeState(
+            Checkpoint::State& state,
+            const std::vector<FilePath>& roots,
+            const Hashing::Options& hashingOptions,
+            const std::function<void(const std::string&, int, int)>& progressCallback
+        );
+
+        // order the files of a group from index from on by path
+        static void sortMembers(DuplicateGroup& group, size_t from);
+
+        // drop files that are not in any size group, noting their
+        // directories in uniqueDirectories
+        static void keepCandidates(
+            FileList& files,
+            FileGroups& sizeGroups,
+            std::vector<FilePath>& uniqueDirectories,
+            std::vector<std::optional<HashValue>>& quickHashes,
+            std::vector<std::optional<HashValue>>& fullHashes
+        );
     };
 }
\ No newline at end of file
@@ -1,62 +1,448 @@
 #include "file_traversal.h"
+#include "glob_matcher.h"
+#include "dupesweep/constants.h"
+
 #include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace dupesweep {
 
+namespace {
+
+int64_t modifiedTime(const struct stat& st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// st_blocks is always in 512 byte units
+FileSize allocatedBytes(const struct stat& st) {
+    return static_cast<FileSize>(st.st_blocks) * 512;
+}
+
+/*
+    walks directories with one set of workers per device (mount point).
+    every directory sits in the queue of the device it lives on, so a slow
+    NFS mount never holds up the local disks and vice versa.
+    names are filtered before anything is stat'ed: excluded or hidden
+    directories are never opened and excluded files never stat'ed
+*/
+class Walker {
+public:
+    Walker(
+        const FileTraversal::Options& options,
+        const std::function<void(const FilePath&)>& progressCallback,
+        const std::function<bool()>& snapshotDue,
+        const std::function<void(FileTraversal::Frontier)>& snapshot
+    )
+        : options(options),
+          progressCallback(progressCallback),
+          snapshotDue(snapshotDue),
+          snapshot(snapshot),
+          includes(options.includeGlobs),
+          excludes(buildExcludes(options)) {}
+
+    FileList run(const std::vector<FilePath>& directories, FileList collected, std::vector<FilePath>& skipped) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            files = std::move(collected);
+            incomplete = std::move(skipped);
+
+            for(const auto& directory: directories) {
+                struct stat st;
+                if(::stat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+                    std::cerr << "error traversing directory " << directory << ": not a directory\n";
+                    continue;
+                }
+                pushLocked(directory, st.st_dev);
+            }
+        }
+
+        waitAndJoin();
+        skipped = std::move(incomplete);
+        return std::move(files);
+    }
+
+private:
+    struct Device {
+        std::deque<FilePath> directories;
+        int workers = 0;
+    };
+
+    static std::vector<std::string> buildExcludes(const FileTraversal::Options& options) {
+        std::vector<std::string> patterns = options.excludeGlobs;
+        if(options.defaultExcludes) {
+            for(const char* name: DEFAULT_EXCLUDES) {
+                patterns.emplace_back(name);
+            }
+        }
+        return patterns;
+    }
+
+    // queue a directory on its device, starting workers for new devices
+    void pushLocked(const FilePath& directory, dev_t device) {
+        Device& lane = devices[device];
+        lane.directories.push_back(directory);
+        pending++;
+
+        while(lane.workers < TRAVERSAL_WORKERS_PER_DEVICE) {
+            lane.workers++;
+            threads.emplace_back(&Walker::work, this, device);
+        }
+
+        ready.notify_all();
+    }
+
+    void waitAndJoin() {
+        std::vector<std::thread> started;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this] { return pending == 0; });
+            started = std::move(threads);
+        }
+
+        for(auto& thread: started) {
+            thread.join();
+        }
+    }
+
+    /*
+        a directory's files and subdirectories are published in one step
+        under the lock, so at any point the collected files plus the queued
+        and active directories describe the walk exactly (the frontier)
+    */
+    void work(dev_t device) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while(true) {
+            Device& lane = devices[device];
+
+            if(!lane.directories.empty()) {
+                FilePath directory = std::move(lane.directories.front());
+                lane.directories.pop_front();
+
+                size_t id = nextActive++;
+                active.emplace(id, directory);
+
+                lock.unlock();
+                FileList localFiles;
+                std::vector<std::pair<FilePath, dev_t>> subdirectories;
+                bool complete = readDirectory(directory, device, localFiles, subdirectories);
+                lock.lock();
+
+                files.insert(files.end(),
+                             std::make_move_iterator(localFiles.begin()),
+                             std::make_move_iterator(localFiles.end()));
+                if(!complete) {
+                    incomplete.push_back(directory);
+                }
+                active.erase(id);
+
+                for(const auto& [path, subDevice]: subdirectories) {
+                    pushLocked(path, subDevice);
+                }
+
+                if(--pending == 0) {
+                    ready.notify_all();
+                } else if(!snapshotting && snapshotDue()) {
+                    // only the copy needs the lock, the other workers go on
+                    // walking while this one saves it
+                    snapshotting = true;
+                    FileTraversal::Frontier frontier = frontierLocked();
+                    lock.unlock();
+                    snapshot(std::move(frontier));
+                    lock.lock();
+                    snapshotting = false;
+                }
+                continue;
+            }
+
+            if(pending == 0) {
+                break;
+            }
+
+            ready.wait(lock);
+        }
+    }
+
+    FileTraversal::Frontier frontierLocked() const {
+        FileTraversal::Frontier frontier;
+        for(const auto& [device, lane]: devices) {
+            frontier.directories.insert(frontier.directories.end(), lane.directories.begin(), lane.directories.end());
+        }
+        for(const auto& [id, directory]: active) {
+            frontier.directories.push_back(directory);
+        }
+        frontier.files = files;
+        frontier.incomplete = incomplete;
+        return frontier;
+    }
+
+    bool skipName(std::string_view name) const {
+        return !options.includeHidden && !name.empty() && name[0] == '.';
+    }
+
+    /*
+        returns false if the directory is not fully described by what was
+        collected: an entry was filtered, hidden, excluded, not a regular
+        file, could not be stat'ed, or the directory is empty or unreadable.
+        such a directory can never be reported as identical to another one
+    */
+    bool readDirectory(
+        const FilePath& directory,
+        dev_t device,
+        FileList& localFiles,
+        std::vector<std::pair<FilePath, dev_t>>& subdirectories
+    ) {
+        int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(fd < 0) {
+            // permission denied subtrees are skipped quietly, like before
+            if(errno != EACCES) {
+                std::cerr << "error traversing directory " << directory << ": " << std::strerror(errno) << "\n";
+            }
+            return false;
+        }
+
+        DIR* dir = ::fdopendir(fd);
+        if(dir == nullptr) {
+            ::close(fd);
+            return false;
+        }
+
+        bool complete = true;
+        bool empty = true;
+
+        std::string base = directory.string();
+        if(base.empty() || base.back() != '/') {
+            base += '/';
+        }
+
+        // one buffer for the whole directory. the full path of an entry is
+        // only built for '/' patterns and for entries that are kept
+        static const std::string noPath;
+        std::string path = base;
+        bool excludesNeedPath = excludes.needsPath();
+        bool includesNeedPath = includes.needsPath();
+
+        while(dirent* entry = ::readdir(dir)) {
+            std::string_view name(entry->d_name);
+            if(name == "." || name == "..") {
+                continue;
+            }
+            empty = false;
+
+            if(skipName(name)) {
+                complete = false;
+                continue;
+            }
+
+            bool pathBuilt = false;
+            auto fullPath = [&]() -> const std::string& {
+                if(!pathBuilt) {
+                    path.resize(base.size());
+                    path.append(name);
+                    pathBuilt = true;
+                }
+                return path;
+            };
+
+            if(excludes.matches(name, excludesNeedPath ? fullPath() : noPath)) {
+                complete = false;
+                continue;
+            }
+
+            unsigned char type = entry->d_type;
+            struct stat st;
+            bool haveStat = false;
+
+            if(type == DT_UNKNOWN) {
+                if(::fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    complete = false;
+                    continue;
+                }
+                haveStat = true;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+            }
+
+            if(type == DT_DIR) {
+                if(!haveStat && ::fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    complete = false;
+                    continue;
+                }
+
+                // a different device means a mount point
+                if(st.st_dev != device && options.oneFileSystem) {
+                    complete = false;
+                    continue;
+                }
+                subdirectories.emplace_back(fullPath(), st.st_dev);
+                continue;
+            }
+
+            // only regular files (no symlinks, devices, sockets...)
+            if(type != DT_REG) {
+                complete = false;
+                continue;
+            }
+
+            if(!includes.empty() && !includes.matches(name, includesNeedPath ? fullPath() : noPath)) {
+                complete = false;
+                continue;
+            }
+
+            if(!haveStat && ::fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                std::cerr << "error accessing file " << fullPath() << ": " << std::strerror(errno) << "\n";
+                complete = false;
+                continue;
+            }
+
+            FileSize size = st.st_size;
+            if(size < options.minSize || size > options.maxSize) {
+                complete = false;
+                continue;
+            }
+
+            FilePath filePath(fullPath());
+            progress(filePath);
+            localFiles.push_back({std::move(filePath), size, modifiedTime(st), st.st_dev, allocatedBytes(st)});
+        }
+
+        ::closedir(dir);
+        return complete && !empty;
+    }
+
+    void progress(const FilePath& path) {
+        std::lock_guard<std::mutex> lock(progressMutex);
+        progressCallback(path);
+    }
+
+    const FileTraversal::Options& options;
+    const std::function<void(const FilePath&)>& progressCallback;
+    const std::function<bool()>& snapshotDue;
+    const std::function<void(FileTraversal::Frontier)>& snapshot;
+    GlobMatcher includes;
+    GlobMatcher excludes;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::map<dev_t, Device> devices;
+    std::vector<std::thread> threads;
+    size_t pending = 0;
+    FileList files;
+    std::vector<FilePath> incomplete;
+    std::map<size_t, FilePath> active;
+    size_t nextActive = 0;
+    bool snapshotting = false;
+
+    std::mutex progressMutex;
+};
+
+/*
+    drop roots that are equal to or nested inside another root,
+    otherwise the same file would be reported as its own duplicate
+*/
+std::vector<FilePath> normalizeRoots(const std::vector<FilePath>& roots) {
+    std::vector<FilePath> canonical;
+    for(const auto& root: roots) {
+        std::error_code ec;
+        FilePath path = fs::canonical(root, ec);
+        if(ec) {
+            std::cerr << "error traversing directory " << root << ": " << ec.message() << "\n";
+            continue;
+        }
+        canonical.push_back(path);
+    }
+
+    auto isInside = [](const FilePath& path, const FilePath& parent) {
+        auto [p, q] = std::mismatch(path.begin(), path.end(), parent.begin(), parent.end());
+        return q == parent.end();
+    };
+
+    std::vector<FilePath> result;
+    for(size_t i=0; i<canonical.size(); i++) {
+        bool nested = false;
+        for(size_t j=0; j<canonical.size() && !nested; j++) {
+            if(i == j) continue;
+            bool inside = isInside(canonical[i], canonical[j]);
+            // of two equal roots keep the first
+            nested = inside && (canonical[i] != canonical[j] || j < i);
+        }
+        if(!nested) {
+            result.push_back(canonical[i]);
+        }
+    }
+
+    return result;
+}
+
+}
+
 FileList FileTraversal::collectFiles(const FilePath& rootDir) {
     return collectFiles(rootDir, [](const FilePath&) {});
 }
 
+FileList FileTraversal::collectFiles(
+    const FilePath& rootDir,
+    const std::function<void(const FilePath&)>& progressCallback
+) {
+    Options options;
+    options.roots.push_back(rootDir);
+    return collectFiles(options, progressCallback);
+}
 
 /*
-    go through rootDir and store {path, size}
+    go through every root and store {path, size}
     only if the file is a regular file (ie not directory, symlink, block file etc)
-    and if it's not a hidden/system file
+    and it passes the hidden/glob/size filters
 */
 FileList FileTraversal::collectFiles(
-    const FilePath& rootDir,
+    const Options& options,
     const std::function<void(const FilePath&)>& progressCallback
 ) {
-    FileList files;
-    
-    try {
-        for(const auto& entry: fs::recursive_directory_iterator(
-            rootDir,
-            fs::directory_options::skip_permission_denied
-        )) {
-            try {
-                if (entry.is_regular_file()) {
-                    FilePath path = entry.path();
+    std::vector<FilePath> incomplete;
+    return collectFiles(options, progressCallback, initialFrontier(options), [] { return false; }, [](Frontier) {}, incomplete);
+}
 
-                    if(shouldProcessFile(path)) {
-                        FileSize size = entry.file_size();
-                        files.emplace_back(path, size);
-                        progressCallback(path);
-                    }
-                }
-            } catch (const fs::filesystem_error& e) {
-                std::cerr << "error accessing file " << entry.path() << ": " << e.what() << "\n";
-            } catch (const std::exception& e) {
-                std::cerr << "error processing file " << entry.path() << ": " << e.what() << "\n";
-            }
-        }
-    } catch (const fs::filesystem_error& e) {
-        std::cerr << "error traversing directory " << rootDir << ": " << e.what() << "\n";
-    }
+FileTraversal::Frontier FileTraversal::initialFrontier(const Options& options) {
+    Frontier start;
+    start.directories = normalizeRoots(options.roots);
+    return start;
+}
 
-    return files;
+FileList FileTraversal::collectFiles(
+    const Options& options,
+    const std::function<void(const FilePath&)>& progressCallback,
+    Frontier start,
+    const std::function<bool()>& snapshotDue,
+    const std::function<void(Frontier)>& snapshot,
+    std::vector<FilePath>& incomplete
+) {
+    Walker walker(options, progressCallback, snapshotDue, snapshot);
+    incomplete = std::move(start.incomplete);
+    return walker.run(start.directories, std::move(start.files), incomplete);
 }
 
-bool FileTraversal::shouldProcessFile(const FilePath& path) {
-    //skip system files and hidden files
-    std::string filename = path.filename().string();
-    
-    //linux hidden files start with '.'
-    if(!filename.empty() && filename[0]=='.') {
+bool FileTraversal::revalidate(FileInfo& file) {
+    struct stat st;
+    if(::lstat(file.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
         return false;
     }
 
+    file.size = st.st_size;
+    file.modified = modifiedTime(st);
+    file.device = st.st_dev;
+    file.allocated = allocatedBytes(st);
     return true;
 }
 
-}
\ No newline at end of file
+}
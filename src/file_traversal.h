@@ -2,10 +2,33 @@
 
 #include "dupesweep/types.h"
 #include <functional>
+#include <limits>
+#include <string>
+#include <vector>
 
 namespace dupesweep {
     class FileTraversal {
         public:
+            struct Options {
+                std::vector<FilePath> roots;
+                bool includeHidden = false;
+                bool oneFileSystem = false;
+                bool defaultExcludes = true;
+                FileSize minSize = 0;
+                FileSize maxSize = std::numeric_limits<FileSize>::max();
+                std::vector<std::string> includeGlobs;
+                std::vector<std::string> excludeGlobs;
+            };
+
+            // state of an unfinished walk: directories still to read,
+            // the files collected so far and the directories read so far
+            // that had an entry left out (see incomplete below)
+            struct Frontier {
+                std::vector<FilePath> directories;
+                FileList files;
+                std::vector<FilePath> incomplete;
+            };
+
             //recursively collect all regular files from a directory
             static FileList collectFiles(const FilePath& rootDir);
 
@@ -15,7 +38,32 @@ namespace dupesweep {
                 const std::function<void(const FilePath&)>& progressCallback
             );
 
-            //check if we should process this file
-            static bool shouldProcessFile(const FilePath& path);
+            //collect files from all roots, applying the filters while walking
+            static FileList collectFiles(
+                const Options& options,
+                const std::function<void(const FilePath&)>& progressCallback
+            );
+
+            //frontier of a walk that has not started yet (the normalized roots)
+            static Frontier initialFrontier(const Options& options);
+
+            //resumable walk, continuing from start.
+            //whenever snapshotDue() returns true between two directories,
+            //snapshot() gets a consistent frontier of the walk.
+            //incomplete receives every directory whose files are not all in
+            //the result (hidden, excluded, filtered or non-regular entries,
+            //unreadable or empty directories)
+            static FileList collectFiles(
+                const Options& options,
+                const std::function<void(const FilePath&)>& progressCallback,
+                Frontier start,
+                const std::function<bool()>& snapshotDue,
+                const std::function<void(Frontier)>& snapshot,
+                std::vector<FilePath>& incomplete
+            );
+
+            //refresh size, mtime and allocated space of a known file
+            //returns false if it is gone or no longer a regular file
+            static bool revalidate(FileInfo& file);
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,76 @@
+#include "glob_matcher.h"
+
+#include <algorithm>
+
+#include <fnmatch.h>
+
+namespace dupesweep {
+
+namespace {
+
+bool hasWildcard(std::string_view pattern) {
+    return pattern.find_first_of("*?[\\") != std::string_view::npos;
+}
+
+}
+
+GlobMatcher::GlobMatcher(const std::vector<std::string>& patterns) {
+    for(const auto& pattern: patterns) {
+        if(pattern.empty()) continue;
+
+        if(pattern.find('/') != std::string::npos) {
+            pathPatterns.push_back(pattern);
+        } else if(!hasWildcard(pattern)) {
+            exactNames.insert(pattern);
+        } else if(pattern.size() > 1 && pattern[0] == '*' && !hasWildcard(std::string_view(pattern).substr(1))) {
+            // "*.ext" style, store the literal tail
+            suffixes.insert(pattern.substr(1));
+            longestSuffix = std::max(longestSuffix, pattern.size() - 1);
+        } else {
+            namePatterns.push_back(pattern);
+        }
+    }
+}
+
+bool GlobMatcher::empty() const {
+    return exactNames.empty() && suffixes.empty() && namePatterns.empty() && pathPatterns.empty();
+}
+
+bool GlobMatcher::needsPath() const {
+    return !pathPatterns.empty();
+}
+
+bool GlobMatcher::matches(std::string_view name, const std::string& path) const {
+    if(!exactNames.empty() && exactNames.count(std::string(name))) {
+        return true;
+    }
+
+    // try every tail of the name that could be a stored suffix
+    if(!suffixes.empty()) {
+        size_t maxLength = std::min(longestSuffix, name.size());
+        for(size_t length=1; length<=maxLength; length++) {
+            if(suffixes.count(std::string(name.substr(name.size() - length)))) {
+                return true;
+            }
+        }
+    }
+
+    if(!namePatterns.empty()) {
+        std::string nameString(name);
+        for(const auto& pattern: namePatterns) {
+            if(fnmatch(pattern.c_str(), nameString.c_str(), 0) == 0) {
+                return true;
+            }
+        }
+    }
+
+    for(const auto& pattern: pathPatterns) {
+        if(fnmatch(pattern.c_str(), path.c_str(), 0) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}
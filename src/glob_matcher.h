@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace dupesweep {
+    /*
+        a set of shell globs compiled once up front.
+        patterns without a '/' are matched against the entry name,
+        patterns with a '/' against the full path.
+        plain names and "*.ext" patterns are answered with hash lookups,
+        anything else falls back to fnmatch
+    */
+    class GlobMatcher {
+    public:
+        GlobMatcher() = default;
+        explicit GlobMatcher(const std::vector<std::string>& patterns);
+
+        //true if no patterns were given
+        bool empty() const;
+
+        //check the entry name (and full path for '/' patterns)
+        bool matches(std::string_view name, const std::string& path) const;
+
+        //true if some pattern needs the full path
+        bool needsPath() const;
+
+    private:
+        std::unordered_set<std::string> exactNames;
+        std::unordered_set<std::string> suffixes;
+        std::vector<std::string> namePatterns;
+        std::vector<std::string> pathPatterns;
+        size_t longestSuffix = 0;
+    };
+}
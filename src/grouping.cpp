@@ -1,28 +1,206 @@
 #include "grouping.h"
+#include "scheduler.h"
+#include "dupesweep/constants.h"
 #include <algorithm>
+#include <array>
 
 namespace dupesweep {
 
-SizeGroup Grouping::groupFilesBySize(const FileList& files) {
-    SizeGroup sizeGroups;
+namespace {
 
-    for(const auto& [path, size]: files) {
-        sizeGroups[size].push_back(path);
+using Histogram = std::array<size_t, 256>;
+
+bool keyLess(const KeyedFile& a, const KeyedFile& b) {
+    return a.key < b.key;
+}
+
+/*
+    LSD radix sort, one byte of the key per pass.
+    each chunk of the input is counted and scattered by its own worker,
+    chunk order is kept in the offsets so the sort stays stable.
+    passes where every key has the same byte are skipped, which makes
+    small sizes (few significant bytes) cheap
+*/
+void radixSort(KeyedFile* data, size_t n, int numThreads) {
+    if(n < RADIX_SORT_MIN_RECORDS) {
+        std::stable_sort(data, data + n, keyLess);
+        return;
     }
 
-    return sizeGroups;
+    size_t chunks = n < PARALLEL_SORT_RECORDS ? 1 : Scheduler::resolveThreadCount(numThreads);
+    size_t chunkSize = (n + chunks - 1) / chunks;
+
+    std::vector<KeyedFile> buffer(n);
+    KeyedFile* src = data;
+    KeyedFile* dst = buffer.data();
+    std::vector<Histogram> histograms(chunks);
+
+    for(int shift=0; shift<64; shift+=8) {
+        Scheduler::parallelFor(chunks, numThreads, [&](size_t c) {
+            Histogram& histogram = histograms[c];
+            histogram.fill(0);
+            size_t end = std::min(n, (c + 1) * chunkSize);
+            for(size_t i=c*chunkSize; i<end; i++) {
+                histogram[(src[i].key >> shift) & 0xff]++;
+            }
+        });
+
+        // turn the counts into write offsets: bucket major, chunk minor
+        size_t offset = 0;
+        bool trivial = false;
+        for(size_t bucket=0; bucket<256; bucket++) {
+            size_t bucketTotal = 0;
+            for(size_t c=0; c<chunks; c++) {
+                size_t count = histograms[c][bucket];
+                histograms[c][bucket] = offset;
+                offset += count;
+                bucketTotal += count;
+            }
+            trivial = trivial || bucketTotal == n;
+        }
+
+        if(trivial) {
+            continue;
+        }
+
+        Scheduler::parallelFor(chunks, numThreads, [&](size_t c) {
+            Histogram& position = histograms[c];
+            size_t end = std::min(n, (c + 1) * chunkSize);
+            for(size_t i=c*chunkSize; i<end; i++) {
+                dst[position[(src[i].key >> shift) & 0xff]++] = src[i];
+            }
+        });
+
+        std::swap(src, dst);
+    }
+
+    if(src != data) {
+        std::copy(src, src + n, data);
+    }
 }
 
-SizeGroup Grouping:: filterPotentialDuplicates(const SizeGroup& sizeGroups) {
-    SizeGroup filteredGroups;
+/*
+    keep the runs of equal key with more than one record.
+    [first, last) of every input range is sorted, survivors are moved
+    down to the write position, which never passes the read position
+*/
+void compactRuns(
+    std::vector<KeyedFile>& records,
+    const std::vector<std::pair<size_t, size_t>>& ranges,
+    std::vector<size_t>& bounds
+) {
+    bounds.assign(1, 0);
+    size_t write = 0;
+
+    for(const auto& [first, last]: ranges) {
+        size_t runStart = first;
+        while(runStart < last) {
+            size_t runEnd = runStart + 1;
+            while(runEnd < last && records[runEnd].key == records[runStart].key) {
+                runEnd++;
+            }
 
-    for(const auto& [size, paths]: sizeGroups) {
-        if(paths.size() > 1) {
-            filteredGroups[size] = paths;
+            if(runEnd - runStart > 1) {
+                // a run already in place is left alone, std::move needs a
+                // destination outside the source range
+                if(write < runStart) {
+                    std::move(records.begin() + runStart, records.begin() + runEnd, records.begin() + write);
+                }
+                write += runEnd - runStart;
+                bounds.push_back(write);
+            }
+            runStart = runEnd;
         }
     }
 
-    return filteredGroups;
+    records.resize(write);
 }
 
-}
\ No newline at end of file
+}
+
+void Grouping::sortByKey(KeyedFile* first, KeyedFile* last, int numThreads) {
+    radixSort(first, last - first, numThreads);
+}
+
+FileGroups Grouping::groupFilesBySize(const FileList& files, int numThreads) {
+    FileGroups groups;
+    groups.records.resize(files.size());
+
+    for(size_t i=0; i<files.size(); i++) {
+        groups.records[i] = {files[i].size, i};
+    }
+
+    sortByKey(groups.records.data(), groups.records.data() + groups.records.size(), numThreads);
+
+    // every run of equal size is a group, singletons included
+    for(size_t i=1; i<=groups.records.size(); i++) {
+        if(i == groups.records.size() || groups.records[i].key != groups.records[i - 1].key) {
+            groups.bounds.push_back(i);
+        }
+    }
+
+    return groups;
+}
+
+void Grouping::filterPotentialDuplicates(FileGroups& groups) {
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for(size_t g=0; g<groups.count(); g++) {
+        if(groups.size(g) > 1) {
+            ranges.emplace_back(groups.bounds[g], groups.bounds[g + 1]);
+        }
+    }
+
+    // the ranges are already runs of one key, compaction only drops singletons
+    compactRuns(groups.records, ranges, groups.bounds);
+}
+
+/*
+    every group is re-keyed and sorted on its own, so records never move
+    across the boundaries of the previous stage. big groups get the whole
+    parallel radix sort one after another, the rest are sorted side by side
+*/
+void Grouping::refineGroups(
+    FileGroups& groups,
+    const std::vector<std::optional<uint64_t>>& keys,
+    int numThreads
+) {
+    std::vector<std::pair<size_t, size_t>> ranges(groups.count());
+    std::vector<size_t> smallGroups;
+
+    auto prepare = [&](size_t g) {
+        size_t first = groups.bounds[g];
+        size_t last = groups.bounds[g + 1];
+
+        // records without a key go to the end of the group and are cut off
+        size_t valid = first;
+        for(size_t i=first; i<last; i++) {
+            if(keys[i]) {
+                KeyedFile record{*keys[i], groups.records[i].file};
+                groups.records[i] = groups.records[valid];
+                groups.records[valid++] = record;
+            }
+        }
+
+        ranges[g] = {first, valid};
+        return valid - first;
+    };
+
+    for(size_t g=0; g<groups.count(); g++) {
+        if(groups.size(g) >= PARALLEL_SORT_RECORDS) {
+            prepare(g);
+            sortByKey(groups.records.data() + ranges[g].first, groups.records.data() + ranges[g].second, numThreads);
+        } else {
+            smallGroups.push_back(g);
+        }
+    }
+
+    Scheduler::parallelFor(smallGroups.size(), numThreads, [&](size_t s) {
+        size_t g = smallGroups[s];
+        prepare(g);
+        radixSort(groups.records.data() + ranges[g].first, ranges[g].second - ranges[g].first, 1);
+    });
+
+    compactRuns(groups.records, ranges, groups.bounds);
+}
+
+}
@@ -1,17 +1,37 @@
 #pragma once
 
 #include "dupesweep/types.h"
+#include <optional>
+#include <vector>
 
 namespace dupesweep {
+    /*
+        sort based grouping engine, used for the size, quick hash and
+        full hash stages alike. records are flat (key, file index) pairs,
+        groups are the runs of equal key after sorting, so there are no
+        per-group allocations and nothing is copied between stages
+    */
     class Grouping {
     public: 
         
         //group files by size
         //each group has files of the same size
-        static SizeGroup groupFilesBySize(const FileList& files);
+        static FileGroups groupFilesBySize(const FileList& files, int numThreads = 0);
 
-        //filter out size groups with only one file
+        //filter out size groups with only one file, in place
         //(no duplicates are possible)
-        static SizeGroup filterPotentialDuplicates(const SizeGroup& sizeGroups);
+        static void filterPotentialDuplicates(FileGroups& groups);
+
+        //give every record a new key (keys is aligned with groups.records)
+        //and split each group into runs of equal key.
+        //records without a key and singleton runs are dropped, in place
+        static void refineGroups(
+            FileGroups& groups,
+            const std::vector<std::optional<uint64_t>>& keys,
+            int numThreads = 0
+        );
+
+        //stable parallel LSD radix sort of records by key
+        static void sortByKey(KeyedFile* first, KeyedFile* last, int numThreads = 0);
     };
-}
\ No newline at end of file
+}
@@ -1,215 +1,674 @@
 #include "hashing.h"
+#include "grouping.h"
+#include "numa.h"
+#include "scheduler.h"
 #include "dupesweep/constants.h"
 
-#include <fstream>
 #include <iomanip>
 #include <sstream>
-#include <thread>
 #include <atomic>
 #include <iostream>
+#include <mutex>
+#include <cerrno>
+#include <cstring>
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <xxhash.h>
 
 namespace dupesweep {
 
-std::string Hashing::quickHash(const FilePath& path) {
-    unsigned char buffer[QUICK_HASH_BYTES];
+Hashing::Cache::Cache(size_t fileCount): quickHashes(fileCount), fullHashes(fileCount) {}
 
-    // open file and read the first QUICK_HASH_BYTES bytes
-    std::ifstream file(path, std::ios::binary);
-    if(!file) {
-        throw std::runtime_error("Cannot open file for quick hashing: " + path.string());
+Hashing::Cache::Cache(std::vector<std::optional<HashValue>> quick, std::vector<std::optional<HashValue>> full)
+    : quickHashes(std::move(quick)), fullHashes(std::move(full)) {}
+
+std::optional<HashValue> Hashing::Cache::quick(FileIndex file) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return quickHashes[file];
+}
+
+std::optional<HashValue> Hashing::Cache::full(FileIndex file) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return fullHashes[file];
+}
+
+void Hashing::Cache::setQuick(FileIndex file, HashValue hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    quickHashes[file] = hash;
+}
+
+void Hashing::Cache::setFull(FileIndex file, HashValue hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    fullHashes[file] = hash;
+}
+
+void Hashing::Cache::snapshot(
+    std::vector<std::optional<HashValue>>& quick,
+    std::vector<std::optional<HashValue>>& full
+) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    quick = quickHashes;
+    full = fullHashes;
+}
+
+Hashing::Budget::Budget(std::function<bool(FileSize)> limit): limit(std::move(limit)) {}
+
+bool Hashing::Budget::spent() {
+    if(!stopped && limit(started)) {
+        stopped = true;
     }
+    return stopped;
+}
 
-    file.read(reinterpret_cast<char*>(buffer), QUICK_HASH_BYTES);
-    size_t bytesRead = file.gcount();
+FileSize Hashing::Budget::bytesStarted() const {
+    return started;
+}
 
-    // calculate xxhash
-    XXH64_hash_t hash = XXH64(buffer, bytesRead, XXHASH_SEED);
+std::vector<FileIndex> Hashing::Budget::takeSkipped() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::move(skipped);
+}
+
+bool Hashing::Budget::admit(FileSize cost) {
+    if(spent()) {
+        return false;
+    }
+    started += cost;
+    return true;
+}
 
-    // convert hash to hex string
+void Hashing::Budget::skip(FileIndex file) {
+    std::lock_guard<std::mutex> lock(mutex);
+    skipped.push_back(file);
+}
+
+std::string Hashing::toHex(HashValue hash) {
     std::stringstream ss;
     ss << std::hex << hash;
     return ss.str();
 }
 
-std::string Hashing::fullHash(const FilePath& path) {
-    unsigned char buffer[HASH_BUFFER_SIZE];
+FileSize Hashing::probeOffset(FileSize size, const Probe& probe) {
+    FileSize bytes = std::min(size, probe.bytes);
+    switch(probe.location) {
+        case ProbeLocation::Middle: return (size - bytes) / 2;
+        case ProbeLocation::Tail: return size - bytes;
+        default: return 0;
+    }
+}
+
+FileSize Hashing::sizeBucket(FileSize size) {
+    FileSize bucket = 1;
+    while(bucket <= size / 2) {
+        bucket *= 2;
+    }
+    return bucket;
+}
+
+const Hashing::Probe& Hashing::probeFor(FileSize size, const Options& options) {
+    auto it = options.probes.find(sizeBucket(size));
+    return it != options.probes.end() ? it->second : options.probe;
+}
+
+namespace {
+
+// closes the descriptor when hashing is done or throws
+struct FileDescriptor {
+    int fd;
+
+    explicit FileDescriptor(const FilePath& path): fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC)) {}
+    ~FileDescriptor() { if(fd >= 0) ::close(fd); }
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+};
+
+/*
+    content is hashed as a sequence of SPARSE_BLOCK_BYTES blocks on a grid
+    starting at offset 0 of the file:
+        'D' + block bytes      for a block with any non-zero byte
+        'Z' + run length (BE)  for a run of all-zero bytes
+    holes and zeros that are actually stored encode the same way, so equal
+    content gives equal digests however it is laid out on disk.
+    the length of the last block follows from the file size, which equal
+    candidates always share
+*/
+class SparseDigest {
+public:
+    explicit SparseDigest(XXH64_state_t* state): state(state) {}
+
+    void zeros(FileSize bytes) {
+        zeroRun += bytes;
+    }
+
+    void data(const unsigned char* block, size_t length) {
+        static const unsigned char zeroBlock[SPARSE_BLOCK_BYTES] = {};
+
+        if(std::memcmp(block, zeroBlock, length) == 0) {
+            zeroRun += length;
+            return;
+        }
+
+        flush();
+        const unsigned char tag = 'D';
+        XXH64_update(state, &tag, 1);
+        XXH64_update(state, block, length);
+    }
+
+    // emit the pending zero run, if any
+    void flush() {
+        if(zeroRun == 0) {
+            return;
+        }
 
-    // open the file
-    std::ifstream file(path, std::ios::binary);
-    if(!file) {
+        unsigned char marker[9];
+        marker[0] = 'Z';
+        for(int i=0; i<8; i++) {
+            marker[1 + i] = static_cast<unsigned char>(zeroRun >> (56 - 8 * i));
+        }
+        XXH64_update(state, marker, sizeof(marker));
+        zeroRun = 0;
+    }
+
+private:
+    XXH64_state_t* state;
+    FileSize zeroRun = 0;
+};
+
+FileSize alignDown(FileSize offset) {
+    return offset - offset % SPARSE_BLOCK_BYTES;
+}
+
+FileSize alignUp(FileSize offset) {
+    return alignDown(offset + SPARSE_BLOCK_BYTES - 1);
+}
+
+/*
+    hash [offset, offset+length) by walking the allocated extents.
+    blocks lying completely inside a hole are never read,
+    blocks touching data are read whole (hole bytes read back as zeros).
+    offset must be a multiple of SPARSE_BLOCK_BYTES
+*/
+uint64_t hashRange(const FilePath& path, FileSize offset, FileSize length, size_t readBytes) {
+    // reused across files, one per worker
+    thread_local std::vector<unsigned char> buffer(HASH_BUFFER_SIZE);
+    if(buffer.size() < readBytes) {
+        buffer.resize(readBytes);
+    }
+
+    FileDescriptor file(path);
+    if(file.fd < 0) {
         throw std::runtime_error("cannot open file for full hashing: " + path.string());
     }
 
-    // initialize xxhash state
     XXH64_state_t* state = XXH64_createState();
     if (state == nullptr) {
         throw std::runtime_error("failed to create xxHash state");
     }
 
     XXH64_reset(state, XXHASH_SEED);
+    SparseDigest digest(state);
+
+    FileSize pos = offset;
+    FileSize end = offset + length;
+
+    try {
+        while(pos < end) {
+            FileSize dataStart = pos;
+            FileSize dataEnd = end;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+            off_t found = ::lseek(file.fd, static_cast<off_t>(pos), SEEK_DATA);
+            if(found >= 0) {
+                dataStart = std::min<FileSize>(alignDown(found), end);
+                dataStart = std::max(dataStart, pos);
+            } else if(errno == ENXIO) {
+                // nothing but hole up to the end of the file
+                dataStart = end;
+            }
 
-    // read and update hash in chunks
-    while(file) {
-        file.read(reinterpret_cast<char*>(buffer), HASH_BUFFER_SIZE);
-        size_t bytesRead = file.gcount();
-        if(bytesRead > 0) {
-            XXH64_update(state, buffer, bytesRead);
-        }
-        if(bytesRead < HASH_BUFFER_SIZE) {
-            break;
+            if(dataStart < end) {
+                off_t hole = ::lseek(file.fd, static_cast<off_t>(dataStart), SEEK_HOLE);
+                if(hole >= 0) {
+                    dataEnd = std::min<FileSize>(alignUp(hole), end);
+                }
+            }
+#endif
+
+            digest.zeros(dataStart - pos);
+            pos = dataStart;
+
+            while(pos < dataEnd) {
+                size_t toRead = std::min<FileSize>(readBytes, dataEnd - pos);
+                size_t bytesRead = 0;
+
+                while(bytesRead < toRead) {
+                    ssize_t n = ::pread(file.fd, buffer.data() + bytesRead, toRead - bytesRead,
+                                        static_cast<off_t>(pos + bytesRead));
+                    if(n < 0 && errno == EINTR) continue;
+                    if(n < 0) {
+                        throw std::runtime_error("read error in file: " + path.string());
+                    }
+                    if(n == 0) {
+                        throw std::runtime_error("file shrank while hashing: " + path.string());
+                    }
+                    bytesRead += n;
+                }
+
+                for(size_t i=0; i<bytesRead; i+=SPARSE_BLOCK_BYTES) {
+                    digest.data(buffer.data() + i, std::min<size_t>(SPARSE_BLOCK_BYTES, bytesRead - i));
+                }
+                pos += bytesRead;
+            }
         }
+    } catch(...) {
+        XXH64_freeState(state);
+        throw;
     }
 
+    digest.flush();
     XXH64_hash_t hash = XXH64_digest(state);
     XXH64_freeState(state);
 
-    // convert hash to hex string
-    std::stringstream ss;
-    ss << std::hex << hash;
-    return ss.str();
+    return hash;
 }
 
-HashGroup Hashing::groupByQuickHash(const std::vector<FilePath>& files) {
-    HashGroup quickHashGroups;
+}
 
-    for(const auto& path: files) {
-        try {
-            std::string hash = quickHash(path);
-            quickHashGroups[hash].push_back(path);
-        } catch (const std::exception& e) {
-            std::cerr << "error hashing file " << path << ": " << e.what() << "\n";
+HashValue Hashing::smallFileHash(const FilePath& path, FileSize size) {
+    // reused across files, one per worker
+    thread_local std::vector<unsigned char> buffer;
+    if(buffer.size() < size) {
+        buffer.resize(size);
+    }
+
+    FileDescriptor file(path);
+    if(file.fd < 0) {
+        throw std::runtime_error("cannot open file for hashing: " + path.string());
+    }
+
+    // normally a single read() returns the whole file
+    size_t bytesRead = 0;
+    while(bytesRead < size) {
+        ssize_t n = ::read(file.fd, buffer.data() + bytesRead, size - bytesRead);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) {
+            throw std::runtime_error("read error in file: " + path.string());
+        }
+        if(n == 0) {
+            throw std::runtime_error("file shrank while hashing: " + path.string());
         }
+        bytesRead += n;
     }
 
-    return quickHashGroups;
+    return XXH64(buffer.data(), bytesRead, XXHASH_SEED);
 }
 
-HashGroup Hashing::groupByFullHash(const std::vector<FilePath>& files) {
-    HashGroup fullHashGroups;
+/*
+    a head probe of QUICK_HASH_BYTES is the classic quick hash, other
+    probes help when files of one size share long identical headers
+    (media containers, zipped office documents)
+*/
+HashValue Hashing::quickHash(const FilePath& path, FileSize size, const Probe& probe) {
+    thread_local std::vector<unsigned char> buffer;
+    size_t bytes = std::min(size, probe.bytes);
+    if(buffer.size() < bytes) {
+        buffer.resize(bytes);
+    }
 
-    for(const auto& path: files) {
-        try {
-            std::string hash = fullHash(path);
-            fullHashGroups[hash].push_back(path);
-        } catch (const std::exception& e) {
-            std::cerr << "error hashing file " << path << ": " << e.what() << "\n";
+    FileDescriptor file(path);
+    if(file.fd < 0) {
+        throw std::runtime_error("Cannot open file for quick hashing: " + path.string());
+    }
+
+    FileSize offset = probeOffset(size, probe);
+    size_t bytesRead = 0;
+    while(bytesRead < bytes) {
+        ssize_t n = ::pread(file.fd, buffer.data() + bytesRead, bytes - bytesRead,
+                            static_cast<off_t>(offset + bytesRead));
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) {
+            throw std::runtime_error("read error in file: " + path.string());
+        }
+        if(n == 0) {
+            break;
         }
+        bytesRead += n;
     }
 
-    return fullHashGroups;
+    return XXH64(buffer.data(), bytesRead, XXHASH_SEED);
 }
 
-HashGroup Hashing::processFilesParallel(
-    const std::vector<FilePath>& files,
-    const std::function<std::string(const FilePath&)>& hashFunction,
-    int numThreads,
-    std::atomic<int>& processedFiles,
-    const std::function<void(int, int)>& progressCallback,
-    int totalFiles
+bool Hashing::isSmallFile(FileSize size, const Options& options) {
+    return size <= options.smallFileBytes;
+}
+
+HashValue Hashing::fullHash(const FilePath& path, FileSize size, size_t readBytes) {
+    return hashRange(path, 0, size, readBytes);
+}
+
+HashValue Hashing::segmentHash(const FilePath& path, FileSize offset, FileSize length, size_t readBytes) {
+    return hashRange(path, offset, length, readBytes);
+}
+
+Hashing::DeviceSettings Hashing::deviceSettings(uint64_t device, const Options& options) {
+    auto it = options.devices.find(device);
+    return it != options.devices.end() ? it->second : DeviceSettings();
+}
+
+/*
+    tree digest, see hashing.h for the layout.
+    segment boundaries only depend on the file size and segment size,
+    so files of the same size always use the same scheme and the result
+    doesn't depend on which worker hashed which segment
+*/
+HashValue Hashing::combineSegments(const std::vector<HashValue>& segmentDigests, FileSize segmentBytes) {
+    std::vector<XXH64_canonical_t> canonical(segmentDigests.size() + 1);
+    XXH64_canonicalFromHash(&canonical[0], segmentBytes);
+    for(size_t i=0; i<segmentDigests.size(); i++) {
+        XXH64_canonicalFromHash(&canonical[i + 1], segmentDigests[i]);
+    }
+
+    return XXH64(canonical.data(), canonical.size() * sizeof(XXH64_canonical_t), XXHASH_SEED);
+}
+
+SplitPolicy Hashing::splitPolicy(const Options& options) {
+    SplitPolicy split;
+    split.minBytes = options.treeHashBytes;
+    split.segmentBytes = options.segmentBytes;
+    return split;
+}
+
+namespace {
+
+// numa setting and budget check of a stage
+RunPolicy runPolicy(const Hashing::Options& options, Hashing::Budget* budget) {
+    RunPolicy policy;
+    policy.numa = options.numa;
+    if(budget != nullptr) {
+        policy.stop = [budget](const HashJob& job) { return !budget->admit(job.cost); };
+    }
+    return policy;
+}
+
+// after a stopped run, record the files of the jobs that never started
+void recordSkipped(
+    const std::vector<HashJob>& jobs,
+    const std::vector<char>& started,
+    Hashing::Budget* budget,
+    const std::function<FileIndex(size_t)>& fileOf
 ) {
-    HashGroup hashGroups;
-    std::mutex hashGroupsMutex;
+    if(budget == nullptr) {
+        return;
+    }
 
-    // determine the number of threads to use
-    int threadCount = numThreads > 0 ? numThreads : std::thread::hardware_concurrency();
+    for(size_t j=0; j<jobs.size(); j++) {
+        if(started[j]) continue;
+        for(size_t item: jobs[j].items) {
+            budget->skip(fileOf(item));
+        }
+    }
+}
 
-    if(threadCount == 0) {
-        threadCount = DEFAULT_THREAD_COUNT;
+// send each job to the node closest to the disk of its first file
+void placeJobs(std::vector<HashJob>& jobs, const Hashing::Options& options, const std::function<uint64_t(size_t)>& deviceOf) {
+    if(!options.numa || !Numa::available()) {
+        return;
     }
 
-    // create a vector of futures
-    std::vector<std::future<void>> futures;
+    for(HashJob& job: jobs) {
+        job.node = Numa::deviceNode(deviceOf(job.items.front()));
+    }
+}
+
+}
 
-    // calculate batch size
-    size_t batchSize = files.size() / threadCount;
-    if(batchSize==0) batchSize = 1;
+std::vector<std::optional<HashValue>> Hashing::quickHashAll(
+    const FileList& files,
+    const std::vector<KeyedFile>& records,
+    const Options& options,
+    const std::function<void(size_t)>& filesDone,
+    Cache* cache,
+    Budget* budget
+) {
+    std::vector<std::optional<HashValue>> quickHashes(records.size());
 
-    // launch the threadds
-    for(size_t i=0; i<files.size(); i+=batchSize) {
-        size_t end = std::min(i+batchSize, files.size());
+    // reuse digests from an earlier run
+    std::vector<size_t> todo;
+    for(size_t r=0; r<records.size(); r++) {
+        if(cache != nullptr) {
+            quickHashes[r] = cache->quick(records[r].file);
+        }
+        if(!quickHashes[r]) {
+            todo.push_back(r);
+        }
+    }
+    filesDone(records.size() - todo.size());
+
+    // small files are read whole, the rest only the probe,
+    // so both go to the small lane and are batched many per job
+    std::vector<FileSize> costs(todo.size());
+    for(size_t t=0; t<todo.size(); t++) {
+        FileSize size = files[records[todo[t]].file].size;
+        costs[t] = isSmallFile(size, options) ? size : std::min<FileSize>(size, probeFor(size, options).bytes);
+    }
 
-        futures.push_back(std::async(std::launch::async, [&, i, end]() {
-            HashGroup localGroups;
+    std::vector<HashJob> jobs = Scheduler::buildJobs(costs);
+    placeJobs(jobs, options, [&](size_t t) { return files[records[todo[t]].file].device; });
+    std::vector<char> started(jobs.size());
+
+    Scheduler::run(jobs, options.numThreads, [&](const HashJob& job) {
+        started[&job - jobs.data()] = 1;
+        for(size_t t: job.items) {
+            size_t r = todo[t];
+            const FilePath& path = files[records[r].file].path;
+            FileSize size = files[records[r].file].size;
+            try {
+                quickHashes[r] = isSmallFile(size, options) ? smallFileHash(path, size) : quickHash(path, size, probeFor(size, options));
+                if(cache != nullptr) {
+                    cache->setQuick(records[r].file, *quickHashes[r]);
+                }
+            } catch(const std::exception& e) {
+                std::cerr << "Error hashing file " << path << ": " << e.what() << "\n";
+            }
+        }
+        filesDone(job.items.size());
+    }, runPolicy(options, budget));
 
-            for(size_t j=i; j<end; j++) {
-                try {
-                    std::string hash = hashFunction(files[j]);
-                    localGroups[hash].push_back(files[j]);
+    recordSkipped(jobs, started, budget, [&](size_t t) { return records[todo[t]].file; });
+    return quickHashes;
+}
+
+std::vector<std::optional<HashValue>> Hashing::fullHashAll(
+    const FileList& files,
+    const std::vector<KeyedFile>& records,
+    const Options& options,
+    const std::function<void(size_t)>& filesDone,
+    Cache* cache,
+    Budget* budget
+) {
+    std::vector<std::optional<HashValue>> fullHashes(records.size());
+
+    // reuse digests from an earlier run
+    std::vector<size_t> todo;
+    for(size_t r=0; r<records.size(); r++) {
+        if(cache != nullptr) {
+            fullHashes[r] = cache->full(records[r].file);
+        }
+        if(!fullHashes[r]) {
+            todo.push_back(r);
+        }
+    }
+    filesDone(records.size() - todo.size());
+
+    std::vector<FileSize> sizes(todo.size());
+    std::vector<std::vector<HashValue>> segmentDigests(todo.size());
+    std::vector<std::atomic<size_t>> segmentsLeft(todo.size());
+    std::vector<std::atomic<bool>> failed(todo.size());
+    SplitPolicy split = splitPolicy(options);
+
+    for(size_t t=0; t<todo.size(); t++) {
+        sizes[t] = files[records[todo[t]].file].size;
+        size_t segments = Scheduler::segmentCount(sizes[t], split);
+        segmentDigests[t].resize(segments);
+        segmentsLeft[t] = segments;
+        failed[t] = false;
+    }
+
+    auto store = [&](size_t t, HashValue hash) {
+        fullHashes[todo[t]] = hash;
+        if(cache != nullptr) {
+            cache->setFull(records[todo[t]].file, hash);
+        }
+    };
+
+    // jobs never mix devices, so a device's concurrency limit applies per job
+    std::vector<uint64_t> devices(todo.size());
+    for(size_t t=0; t<todo.size(); t++) {
+        devices[t] = files[records[todo[t]].file].device;
+    }
 
-                    //update progress
-                    int processed = ++processedFiles;
-                    progressCallback(processed, totalFiles);
+    std::vector<HashJob> jobs = Scheduler::buildJobs(sizes, split, devices);
+    placeJobs(jobs, options, [&](size_t t) { return devices[t]; });
+    std::vector<char> started(jobs.size());
+
+    RunPolicy policy = runPolicy(options, budget);
+    for(const auto& [device, settings]: options.devices) {
+        if(settings.concurrency > 0) {
+            policy.deviceLimits[device] = settings.concurrency;
+        }
+    }
+
+    Scheduler::run(jobs, options.numThreads, [&](const HashJob& job) {
+        started[&job - jobs.data()] = 1;
+        if(!job.isSegment) {
+            for(size_t t: job.items) {
+                const FileInfo& file = files[records[todo[t]].file];
+                try {
+                    store(t, fullHash(file.path, file.size, deviceSettings(file.device, options).readBytes));
                 } catch(const std::exception& e) {
-                    std::cerr << "Error hashing file " << files[j] << ": " << e.what() << "\n";
+                    std::cerr << "Error hashing file " << file.path << ": " << e.what() << "\n";
                 }
             }
+            filesDone(job.items.size());
+            return;
+        }
+
+        // one segment of a split file, the last one to finish combines
+        size_t t = job.items.front();
+        const FileInfo& file = files[records[todo[t]].file];
+        try {
+            segmentDigests[t][job.segment] = segmentHash(file.path, job.offset, job.length,
+                                                         deviceSettings(file.device, options).readBytes);
+        } catch(const std::exception& e) {
+            if(!failed[t].exchange(true)) {
+                std::cerr << "Error hashing file " << file.path << ": " << e.what() << "\n";
+            }
+        }
 
-            // merge local results with global
-            std::lock_guard<std::mutex> lock(hashGroupsMutex);
-            for(const auto& [hash, paths]: localGroups) {
-                hashGroups[hash].insert(hashGroups[hash].end(), paths.begin(), paths.end());
+        if(--segmentsLeft[t] == 0) {
+            if(!failed[t]) {
+                store(t, combineSegments(segmentDigests[t], split.segmentBytes));
             }
-        }));
+            filesDone(1);
+        }
+    }, policy);
+
+    // a split file with any segment skipped is skipped as a whole
+    recordSkipped(jobs, started, budget, [&](size_t t) { return records[todo[t]].file; });
+    return fullHashes;
+}
+
+std::vector<std::optional<HashValue>> Hashing::finalHashes(
+    const FileList& files,
+    const std::vector<KeyedFile>& records,
+    const Options& options,
+    const std::function<void(size_t)>& filesDone,
+    Cache* cache,
+    Budget* budget
+) {
+    std::vector<std::optional<HashValue>> hashes(records.size());
+    std::vector<KeyedFile> large;
+    std::vector<size_t> largeRecord;
+    for(size_t r=0; r<records.size(); r++) {
+        if(isSmallFile(files[records[r].file].size, options)) {
+            hashes[r] = records[r].key;
+        } else {
+            large.push_back(records[r]);
+            largeRecord.push_back(r);
+        }
     }
+    filesDone(records.size() - large.size());
 
-    // wait for all threads to complete
-    for(auto& future: futures) {
-        future.wait();
+    if(large.empty()) {
+        return hashes;
     }
 
-    return hashGroups;
+    std::vector<std::optional<HashValue>> largeHashes = fullHashAll(files, large, options, filesDone, cache, budget);
+    for(size_t l=0; l<large.size(); l++) {
+        hashes[largeRecord[l]] = largeHashes[l];
+    }
+    return hashes;
 }
 
-HashGroup Hashing::findDuplicates(
-    const SizeGroup& sizeGroups,
-    int numThreads,
-    const std::function<void(int, int)>& progressCallback
+/*
+    both stages run over all candidates at once instead of one size group
+    at a time, so the scheduler always sees the whole remaining workload.
+    stage 1: quick hash of every candidate (small lane batches),
+             small files get their final digest from this single read
+    stage 2: full hash of every larger file whose (size, quick hash)
+             collides, largest first, very large files split into segments
+    after each stage the groups are refined in place by the grouping engine
+*/
+FileGroups Hashing::findDuplicates(
+    const FileList& files,
+    FileGroups sizeGroups,
+    const Options& options,
+    const std::function<void(int, int)>& progressCallback,
+    Cache* cache,
+    FileSize* bytesRead,
+    Budget* budget
 ) {
-    HashGroup duplicates;
+    FileGroups groups = std::move(sizeGroups);
 
-    // count total files for progress reporting
-    int totalFiles = 0;
-    for(const auto& [size, paths]: sizeGroups) {
-        totalFiles += paths.size();
+    // a file counts as processed once it is eliminated or fully hashed
+    int totalFiles = groups.records.size();
+    std::atomic<int> processedFiles(0);
+    std::mutex progressMutex;
+
+    auto reportProgress = [&](size_t count) {
+        int processed = processedFiles += count;
+        std::lock_guard<std::mutex> lock(progressMutex);
+        progressCallback(processed, totalFiles);
+    };
+
+    FileSize readBytes = 0;
+    for(const KeyedFile& record: groups.records) {
+        FileSize size = files[record.file].size;
+        readBytes += isSmallFile(size, options) ? size : std::min<FileSize>(size, probeFor(size, options).bytes);
     }
 
-    std::atomic<int> processedFiles(0);
+    // stage 1: quick hash, then split the size groups by it
+    std::vector<std::optional<HashValue>> quickHashes = quickHashAll(files, groups.records, options, [](size_t) {}, cache, budget);
+    Grouping::refineGroups(groups, quickHashes, options.numThreads);
 
-    // process each size group
-    for(const auto& [size, paths]: sizeGroups) {
-        //skip singleton groups
-        if(paths.size() <= 1) continue;
-
-        // group by quick hash first
-        HashGroup quickHashGroups = groupByQuickHash(paths);
-
-        // for each quick hash group, calculate full hash
-        for(const auto& [quickHash, quickHashPaths]: quickHashGroups) {
-            // skip singleton groups
-            if(quickHashPaths.size() <= 1) continue;
-            
-            // calculate full hashes in parallel
-            HashGroup fullHashGroups = processFilesParallel(
-                quickHashPaths,
-                fullHash,
-                numThreads,
-                processedFiles,
-                progressCallback,
-                totalFiles
-            );
-
-            // add duplicate groups to results
-            for(const auto& [fullHash, fullHashPaths]: fullHashGroups) {
-                if(fullHashPaths.size() > 1) {
-                    duplicates[fullHash] = fullHashPaths;
-                }
-            }
+    // small files are final now, only the larger ones need stage 2
+    reportProgress(totalFiles - groups.records.size());
+    for(const KeyedFile& record: groups.records) {
+        if(!isSmallFile(files[record.file].size, options)) {
+            readBytes += files[record.file].size;
         }
     }
+    if(bytesRead != nullptr) {
+        *bytesRead += readBytes;
+    }
+
+    // stage 2: full hash of the larger files that survived
+    std::vector<std::optional<HashValue>> keys = finalHashes(files, groups.records, options, reportProgress, cache, budget);
+    Grouping::refineGroups(groups, keys, options.numThreads);
 
-    return duplicates;
+    return groups;
 }
 
 }
\ No newline at end of file
@@ -1,42 +1,216 @@
 #pragma once
 
 #include "dupesweep/types.h"
+#include "dupesweep/constants.h"
+#include "scheduler.h"
+#include <atomic>
 #include <functional>
+#include <map>
 #include <mutex>
-#include <future>
+#include <optional>
+#include <string>
+#include <vector>
 
 namespace dupesweep {
     class Hashing {
     public: 
+        // where the quick hash samples a file too large to read whole
+        enum class ProbeLocation : uint8_t { Head, Middle, Tail };
 
-        //calculate quick hash (first few bytes) for a file
-        static std::string quickHash(const FilePath& path);
+        struct Probe {
+            FileSize bytes = QUICK_HASH_BYTES;
+            ProbeLocation location = ProbeLocation::Head;
 
-        //calculate full hash (sha-256) for a file
-        static std::string fullHash(const FilePath& path);
+            bool operator==(const Probe& other) const{
+                return bytes == other.bytes && location == other.location;
+            }
+        };
 
-        //group files by quick hash within a size group
-        static HashGroup groupByQuickHash(const std::vector<FilePath>& files);
+        // how full hashing reads the files of one device
+        struct DeviceSettings {
+            size_t readBytes = HASH_BUFFER_SIZE;   // multiple of SPARSE_BLOCK_BYTES
+            int concurrency = 0;                  // full hash jobs at once, 0 = no limit
+        };
 
-        //group files by full hash within a quick hash group
-        static HashGroup groupByFullHash(const std::vector<FilePath>& files);
+        struct Options {
+            int numThreads = 0;
 
-        //perform full duplicate detection and report progress
-        static HashGroup findDuplicates(
-            const SizeGroup& sizeGroups,
-            int numThreads = 0,
-            const std::function<void(int, int)>& progressCallback = [](int, int) {}
+            // files up to this size are read once and hashed in one shot,
+            // that digest serves as both quick and full hash
+            FileSize smallFileBytes = SMALL_FILE_HASH_BYTES;
+
+            // files of at least treeHashBytes are tree hashed (0 = never),
+            // segmentBytes must be a multiple of SPARSE_BLOCK_BYTES
+            FileSize treeHashBytes = SPLIT_FILE_BYTES;
+            FileSize segmentBytes = SEGMENT_BYTES;
+
+            // a worker pool per NUMA node, used only when sysfs shows
+            // more than one node
+            bool numa = true;
+
+            // quick hash sample of larger files. probes holds the ones
+            // chosen per size bucket, keyed by sizeBucket(), the rest of
+            // the larger files use probe
+            Probe probe;
+            std::map<FileSize, Probe> probes;
+
+            // per device (st_dev) read settings, others use the defaults
+            std::map<uint64_t, DeviceSettings> devices;
+        };
+
+        // digests per FileIndex that outlive a run (checkpoint/resume).
+        // the stages skip files that already have one and record new ones
+        class Cache {
+        public:
+            explicit Cache(size_t fileCount = 0);
+            Cache(std::vector<std::optional<HashValue>> quick, std::vector<std::optional<HashValue>> full);
+
+            std::optional<HashValue> quick(FileIndex file) const;
+            std::optional<HashValue> full(FileIndex file) const;
+            void setQuick(FileIndex file, HashValue hash);
+            void setFull(FileIndex file, HashValue hash);
+
+            //consistent copy of both tables while workers keep updating
+            void snapshot(
+                std::vector<std::optional<HashValue>>& quick,
+                std::vector<std::optional<HashValue>>& full
+            ) const;
+
+        private:
+            mutable std::mutex mutex;
+            std::vector<std::optional<HashValue>> quickHashes;
+            std::vector<std::optional<HashValue>> fullHashes;
+        };
+
+        // stops hashing early (anytime limits). every job adds its bytes
+        // before it starts, once the limit says the bytes started so far
+        // (or anything else it checks) are enough, no further job starts.
+        // the files of jobs that never ran are recorded as skipped
+        class Budget {
+        public:
+            explicit Budget(std::function<bool(FileSize)> limit);
+
+            //true once no more jobs may start
+            bool spent();
+
+            //bytes of all jobs started so far
+            FileSize bytesStarted() const;
+
+            //files left unhashed since the last call
+            std::vector<FileIndex> takeSkipped();
+
+            //called by the stages: true if a job of this cost may start
+            bool admit(FileSize cost);
+            void skip(FileIndex file);
+
+        private:
+            std::function<bool(FileSize)> limit;
+            std::atomic<FileSize> started{0};
+            std::atomic<bool> stopped{false};
+            std::mutex mutex;
+            std::vector<FileIndex> skipped;
+        };
+
+        //quick hash of probe.bytes at the probe location of a file
+        static HashValue quickHash(const FilePath& path, FileSize size, const Probe& probe);
+
+        //offset of the probe in a file of this size
+        static FileSize probeOffset(FileSize size, const Probe& probe);
+
+        //size bucket of a file: the largest power of two up to its size
+        static FileSize sizeBucket(FileSize size);
+
+        //probe used for a larger file of this size
+        static const Probe& probeFor(FileSize size, const Options& options);
+
+        //hash a small file in one read of exactly size bytes
+        static HashValue smallFileHash(const FilePath& path, FileSize size);
+
+        //true if files of this size take the one-shot path
+        static bool isSmallFile(FileSize size, const Options& options);
+
+        //calculate full hash (xxhash) for a file
+        //walks allocated extents, holes are hashed as zero runs without reading them
+        //readBytes is the size of each read, a multiple of SPARSE_BLOCK_BYTES
+        //size is the file size found by the traversal
+        static HashValue fullHash(const FilePath& path, FileSize size, size_t readBytes = HASH_BUFFER_SIZE);
+
+        //hash one segment [offset, offset+length) of a file
+        static HashValue segmentHash(
+            const FilePath& path,
+            FileSize offset,
+            FileSize length,
+            size_t readBytes = HASH_BUFFER_SIZE
+        );
+
+        //read settings for files on a device
+        static DeviceSettings deviceSettings(uint64_t device, const Options& options);
+
+        /*
+            tree digest of a file of at least treeHashBytes:
+                segment i   = bytes [i * segmentBytes, min((i+1) * segmentBytes, size))
+                d_i         = segmentHash of segment i (sparse aware, like fullHash)
+                digest      = XXH64(BE64(segmentBytes) || BE64(d_0) || ... || BE64(d_n-1), XXHASH_SEED)
+            segments are hashed by different workers, combining in segment
+            order keeps the digest independent of the thread count
+        */
+        static HashValue combineSegments(const std::vector<HashValue>& segmentDigests, FileSize segmentBytes);
+
+        //segment layout used for tree hashing
+        static SplitPolicy splitPolicy(const Options& options);
+
+        //hex form of a digest, as shown to the user
+        static std::string toHex(HashValue hash);
+
+        //quick hash the file of every record in parallel,
+        //small files get their final one-shot digest instead
+        //the result is aligned with records, empty where hashing failed
+        //filesDone is called with the number of files finished
+        static std::vector<std::optional<HashValue>> quickHashAll(
+            const FileList& files,
+            const std::vector<KeyedFile>& records,
+            const Options& options,
+            const std::function<void(size_t)>& filesDone = [](size_t) {},
+            Cache* cache = nullptr,
+            Budget* budget = nullptr
+        );
+
+        //full hash the file of every record in parallel, largest first,
+        //very large files split into segments
+        static std::vector<std::optional<HashValue>> fullHashAll(
+            const FileList& files,
+            const std::vector<KeyedFile>& records,
+            const Options& options,
+            const std::function<void(size_t)>& filesDone = [](size_t) {},
+            Cache* cache = nullptr,
+            Budget* budget = nullptr
+        );
+
+        //final digest of every record whose key is its quick hash result:
+        //small files already have it (their one-shot digest), the larger
+        //ones are full hashed. the result is aligned with records
+        static std::vector<std::optional<HashValue>> finalHashes(
+            const FileList& files,
+            const std::vector<KeyedFile>& records,
+            const Options& options,
+            const std::function<void(size_t)>& filesDone = [](size_t) {},
+            Cache* cache = nullptr,
+            Budget* budget = nullptr
         );
 
-    private:
-        //process a batch of files in parallel
-        static HashGroup processFilesParallel(\
-            const std::vector<FilePath>& files,
-            const std::function<std::string(const FilePath&)>& hashFunction,
-            int numThreads,
-            std::atomic<int>& processedFiles,
-            const std::function<void(int, int)>& progressCallback,
-            int totalFiles
+        //perform full duplicate detection on size groups and report progress
+        //returns the groups of identical files, keyed by full hash
+        //bytesRead (if given) is increased by the bytes scheduled for reading
+        //with a budget, files whose jobs were skipped are missing from the
+        //result and listed by budget->takeSkipped()
+        static FileGroups findDuplicates(
+            const FileList& files,
+            FileGroups sizeGroups,
+            const Options& options,
+            const std::function<void(int, int)>& progressCallback = [](int, int) {},
+            Cache* cache = nullptr,
+            FileSize* bytesRead = nullptr,
+            Budget* budget = nullptr
         );
     };
 }
\ No newline at end of file
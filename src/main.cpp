@@ -13,45 +13,77 @@ int main(int argc, char* argv[]) {
     CLI::Options options = CLI::parseArgs(argc, argv);
 
     std::cout << "DupeSweep - Duplicate File Finder" << std::endl;
-    std::cout << "Scanning directory: " << options.rootDir.string() << std::endl;
-    std::cout << "Using " << options.numThreads << " threads" << std::endl;
+    for (const auto& root : options.traversal.roots) {
+        std::cout << "Scanning directory: " << root.string() << std::endl;
+    }
+    std::cout << "Using " << options.hashing.numThreads << " threads" << std::endl;
 
     // record start time
     auto startTime = std::chrono::steady_clock::now();
 
-    // find duplicates and report progress
-    DuplicateList duplicates = DuplicateDetection::findDuplicates(
-        options.rootDir,
-        options.numThreads,
-        [&options](const std::string& message, int current, int total) {
-            // only show detailed progress in verbose mode
-            if (options.verbose || current == 0) {
-                std::cout << message;
-                if (total > 0) {
-                    std::cout << " (" << current << "/" << total;
-                    if (current > 0) {
-                         std::cout << ", " << (current * 100 / total) << "%";
-                    }
-                    std::cout << ")";
+    // report progress
+    auto progress = [&options](const std::string& message, int current, int total) {
+        // only show detailed progress in verbose mode
+        if (options.verbose || current == 0) {
+            std::cout << message;
+            if (total > 0) {
+                std::cout << " (" << current << "/" << total;
+                if (current > 0) {
+                     std::cout << ", " << (current * 100 / total) << "%";
                 }
-                std::cout << std::endl;
+                std::cout << ")";
             }
-            else if (!options.verbose && total > 0 && current > 0 ) {
-                static int last_percentage = -1;
-                int current_percentage = (current * 100 / total);
-                if (current_percentage > last_percentage || current == total) {
-                    std::cout << "\rProgress: " << current_percentage << "% completed (" << current << "/" << total << ")..." << std::flush;
-                    last_percentage = current_percentage;
-                }
-                if (current == total) {
-                    std::cout << std::endl;
-                }
+            std::cout << std::endl;
+        }
+        else if (!options.verbose && total > 0 && current > 0 ) {
+            static int last_percentage = -1;
+            int current_percentage = (current * 100 / total);
+            if (current_percentage > last_percentage || current == total) {
+                std::cout << "\rProgress: " << current_percentage << "% completed (" << current << "/" << total << ")..." << std::flush;
+                last_percentage = current_percentage;
             }
-            else if (!options.verbose && total == 0) {
-                 std::cout << message << std::endl;
+            if (current == total) {
+                std::cout << std::endl;
             }
         }
-    );
+        else if (!options.verbose && total == 0) {
+             std::cout << message << std::endl;
+        }
+    };
+
+    // anytime mode prints every group as soon as it is confirmed
+    int streamedGroups = 0;
+    if (options.detection.anytime) {
+        options.detection.onGroup = [&streamedGroups](const DuplicateGroup& group) {
+            std::cout << "\r" << std::string(100, ' ') << "\r";
+            CLI::displayGroup(group, ++streamedGroups);
+        };
+    }
+
+    DuplicateList duplicates;
+    DuplicateDetection::Stats stats;
+    try {
+        if (!options.saveIndex.empty()) {
+            // index mode: hash everything, save and exit
+            size_t indexed = DuplicateDetection::buildIndex(
+                options.traversal, options.saveIndex, options.hashing, progress);
+            std::cout << "Indexed " << indexed << " files into " << options.saveIndex.string() << std::endl;
+            return 0;
+        }
+
+        if (!options.queryIndex.empty()) {
+            // query mode: files of the new tree that already exist in the index
+            duplicates = DuplicateDetection::queryIndex(
+                options.traversal, options.queryIndex, options.hashing, progress);
+        } else {
+            // find duplicates and report progress
+            duplicates = DuplicateDetection::findDuplicates(
+                options.traversal, options.hashing, options.checkpoint, options.detection, progress, &stats);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
 
     auto endTime = std::chrono::steady_clock::now();
 
@@ -72,8 +104,11 @@ int main(int argc, char* argv[]) {
     std::cout << std::endl;
 
     // display results
-    CLI::displayDuplicates(duplicates);
+    if (!options.detection.anytime) {
+        CLI::displayDuplicates(duplicates);
+    }
     CLI::displaySummary(duplicates);
+    CLI::displayStats(stats);
     
     if (!duplicates.empty()) {
         std::cout << std::endl;
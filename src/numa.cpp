@@ -0,0 +1,154 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/sysmacros.h>
+
+namespace dupesweep {
+
+namespace {
+
+const FilePath NODE_ROOT = "/sys/devices/system/node";
+
+// parse a sysfs cpu list like "0-7,16-23"
+std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    std::stringstream ss(text);
+    std::string range;
+
+    while(std::getline(ss, range, ',')) {
+        if(range.empty() || range == "\n") continue;
+
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for(int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        } catch(const std::exception&) {
+            return {};
+        }
+    }
+    return cpus;
+}
+
+std::string readLine(const FilePath& path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+std::vector<Numa::Node> readNodes() {
+    std::vector<Numa::Node> nodes;
+
+    std::error_code ec;
+    for(const auto& entry: fs::directory_iterator(NODE_ROOT, ec)) {
+        std::string name = entry.path().filename().string();
+        if(name.rfind("node", 0) != 0 || name.size() == 4) continue;
+
+        Numa::Node node;
+        try {
+            node.id = std::stoi(name.substr(4));
+        } catch(const std::exception&) {
+            continue;
+        }
+
+        // memory only nodes get no workers
+        node.cpus = parseCpuList(readLine(entry.path() / "cpulist"));
+        if(!node.cpus.empty()) {
+            nodes.push_back(std::move(node));
+        }
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const Numa::Node& a, const Numa::Node& b) {
+        return a.id < b.id;
+    });
+    return nodes;
+}
+
+/*
+    /sys/dev/block/MAJ:MIN points at the disk or partition, the numa_node
+    attribute sits on the controller (PCI device) somewhere above it,
+    so walk up from the device link until one is found
+*/
+int readDeviceNode(uint64_t device) {
+    FilePath link = "/sys/dev/block/" + std::to_string(major(device)) + ":" + std::to_string(minor(device));
+
+    std::error_code ec;
+    FilePath path = fs::canonical(link / "device", ec);
+    if(ec) {
+        // partitions have no device link of their own, their disk does
+        path = fs::canonical(link / ".." / "device", ec);
+        if(ec) return -1;
+    }
+
+    for(; path.has_relative_path() && path != "/sys/devices"; path = path.parent_path()) {
+        std::string value = readLine(path / "numa_node");
+        if(value.empty()) continue;
+
+        try {
+            return std::stoi(value);
+        } catch(const std::exception&) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+}
+
+const std::vector<Numa::Node>& Numa::nodes() {
+    static const std::vector<Node> topology = readNodes();
+    return topology;
+}
+
+bool Numa::available() {
+    return nodes().size() > 1;
+}
+
+int Numa::deviceNode(uint64_t device) {
+    static std::mutex mutex;
+    static std::unordered_map<uint64_t, int> known;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = known.find(device);
+    if(it != known.end()) {
+        return it->second;
+    }
+
+    // map the kernel's node id to our position in nodes()
+    int id = readDeviceNode(device);
+    int position = -1;
+    for(size_t n=0; n<nodes().size(); n++) {
+        if(nodes()[n].id == id) {
+            position = n;
+        }
+    }
+
+    known.emplace(device, position);
+    return position;
+}
+
+void Numa::bindThread(size_t node) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu: nodes()[node].cpus) {
+        if(cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    // best effort, a restricted cpuset just leaves the thread floating
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "dupesweep/types.h"
+#include <vector>
+
+namespace dupesweep {
+    /*
+        NUMA topology read from sysfs at runtime. on single node machines
+        (or without sysfs) nodes() has at most one entry and callers keep
+        their plain code paths
+    */
+    class Numa {
+    public:
+        struct Node {
+            int id;
+            std::vector<int> cpus;
+        };
+
+        //online nodes that have cpus, read once
+        static const std::vector<Node>& nodes();
+
+        //true if there is more than one node to care about
+        static bool available();
+
+        //position in nodes() of the node closest to the controller of a
+        //block device (st_dev), -1 if unknown (network, tmpfs, no sysfs)
+        static int deviceNode(uint64_t device);
+
+        //pin the calling thread to the cpus of nodes()[node]
+        static void bindThread(size_t node);
+    };
+}
@@ -0,0 +1,390 @@
+#include "scheduler.h"
+#include "numa.h"
+#include "dupesweep/constants.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace dupesweep {
+
+namespace {
+
+// workers per NUMA node follow the node's share of the cpus
+std::vector<size_t> workersPerNode(size_t threadCount) {
+    const std::vector<Numa::Node>& nodes = Numa::nodes();
+    size_t nodeCount = nodes.size();
+
+    size_t totalCpus = 0;
+    for(const auto& node: nodes) {
+        totalCpus += node.cpus.size();
+    }
+
+    std::vector<size_t> workers(nodeCount, 0);
+    size_t assigned = 0;
+    for(size_t n=0; n<nodeCount; n++) {
+        workers[n] = threadCount * nodes[n].cpus.size() / totalCpus;
+        assigned += workers[n];
+    }
+    for(size_t n=0; assigned < threadCount; n = (n + 1) % nodeCount) {
+        workers[n]++;
+        assigned++;
+    }
+    return workers;
+}
+
+}
+
+size_t Scheduler::segmentCount(FileSize size, const SplitPolicy& split) {
+    if(split.minBytes == 0 || split.segmentBytes == 0 || size < split.minBytes) {
+        return 0;
+    }
+    return (size + split.segmentBytes - 1) / split.segmentBytes;
+}
+
+/*
+    small lane: consecutive small files are packed into one job until the
+    batch reaches SMALL_BATCH_BYTES or SMALL_BATCH_FILES.
+    large lane: one job per file, or one job per segment for very large files.
+    all jobs are then sorted by cost, largest first, so the long jobs start
+    early and the small batches fill the gaps at the end of the run
+*/
+std::vector<HashJob> Scheduler::buildJobs(
+    const std::vector<FileSize>& costs,
+    const SplitPolicy& split,
+    const std::vector<uint64_t>& devices
+) {
+    std::vector<HashJob> jobs;
+
+    // one open batch per device
+    std::map<uint64_t, HashJob> batches;
+
+    for(size_t i=0; i<costs.size(); i++) {
+        FileSize cost = costs[i];
+        uint64_t device = devices.empty() ? 0 : devices[i];
+
+        // the split decides the digest scheme, so it comes before the lane:
+        // a file at or above split.minBytes is tree hashed whatever its size
+        size_t segments = segmentCount(cost, split);
+
+        if(segments == 0 && cost <= SMALL_FILE_BYTES) {
+            HashJob& batch = batches[device];
+            batch.device = device;
+            batch.items.push_back(i);
+            batch.cost += cost;
+
+            if(batch.cost >= SMALL_BATCH_BYTES || batch.items.size() >= SMALL_BATCH_FILES) {
+                jobs.push_back(std::move(batch));
+                batches.erase(device);
+            }
+            continue;
+        }
+
+        if(segments == 0) {
+            HashJob job;
+            job.items.push_back(i);
+            job.cost = cost;
+            job.device = device;
+            jobs.push_back(std::move(job));
+            continue;
+        }
+
+        for(size_t s=0; s<segments; s++) {
+            HashJob job;
+            job.items.push_back(i);
+            job.device = device;
+            job.isSegment = true;
+            job.segment = s;
+            job.offset = static_cast<FileSize>(s) * split.segmentBytes;
+            job.length = std::min<FileSize>(split.segmentBytes, cost - job.offset);
+            job.cost = job.length;
+            jobs.push_back(std::move(job));
+        }
+    }
+
+    for(auto& [device, batch]: batches) {
+        jobs.push_back(std::move(batch));
+    }
+
+    // stable so that segments of one file stay adjacent
+    std::stable_sort(jobs.begin(), jobs.end(), [](const HashJob& a, const HashJob& b) {
+        return a.cost > b.cost;
+    });
+
+    return jobs;
+}
+
+int Scheduler::resolveThreadCount(int numThreads) {
+    int threadCount = numThreads > 0 ? numThreads : std::thread::hardware_concurrency();
+
+    if(threadCount == 0) {
+        threadCount = DEFAULT_THREAD_COUNT;
+    }
+
+    return threadCount;
+}
+
+void Scheduler::run(
+    const std::vector<HashJob>& jobs,
+    int numThreads,
+    const std::function<void(const HashJob&)>& worker,
+    const RunPolicy& policy
+) {
+    if(jobs.empty()) {
+        return;
+    }
+
+    size_t threadCount = std::min<size_t>(resolveThreadCount(numThreads), jobs.size());
+    if(!policy.deviceLimits.empty() && threadCount > 1) {
+        runLimited(jobs, threadCount, worker, policy);
+        return;
+    }
+    if(policy.numa && threadCount > 1 && Numa::available()) {
+        runOnNodes(jobs, threadCount, worker, policy);
+        return;
+    }
+    std::atomic<size_t> nextJob(0);
+    std::atomic<bool> stopped(false);
+
+    // workers pull jobs instead of getting a fixed slice,
+    // so nobody goes idle while work remains
+    auto loop = [&]() {
+        for(size_t i = nextJob++; i < jobs.size() && !stopped; i = nextJob++) {
+            if(policy.stop && policy.stop(jobs[i])) {
+                stopped = true;
+                break;
+            }
+            worker(jobs[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(size_t t=1; t<threadCount; t++) {
+        threads.emplace_back(loop);
+    }
+    loop();
+
+    for(auto& thread: threads) {
+        thread.join();
+    }
+}
+
+/*
+    one queue per node, each keeping the largest first order. jobs tagged
+    with a node go to its queue, the rest to the queue with the least work.
+    workers are pinned to their node before they touch their thread_local
+    read buffers, so first touch puts the buffers in node local memory.
+    a worker whose queue runs dry helps the other nodes
+*/
+void Scheduler::runOnNodes(
+    const std::vector<HashJob>& jobs,
+    size_t threadCount,
+    const std::function<void(const HashJob&)>& worker,
+    const RunPolicy& policy
+) {
+    const std::vector<Numa::Node>& nodes = Numa::nodes();
+    size_t nodeCount = nodes.size();
+
+    std::vector<std::vector<size_t>> queues(nodeCount);
+    std::vector<FileSize> load(nodeCount, 0);
+    for(size_t i=0; i<jobs.size(); i++) {
+        size_t node;
+        if(jobs[i].node >= 0 && static_cast<size_t>(jobs[i].node) < nodeCount) {
+            node = jobs[i].node;
+        } else {
+            node = std::min_element(load.begin(), load.end()) - load.begin();
+        }
+        queues[node].push_back(i);
+        load[node] += jobs[i].cost;
+    }
+
+    std::vector<size_t> workers = workersPerNode(threadCount);
+
+    std::vector<std::atomic<size_t>> next(nodeCount);
+    for(auto& index: next) {
+        index = 0;
+    }
+
+    std::atomic<bool> stopped(false);
+
+    auto loop = [&](size_t home) {
+        Numa::bindThread(home);
+
+        for(size_t k=0; k<nodeCount && !stopped; k++) {
+            size_t q = (home + k) % nodeCount;
+            for(size_t i = next[q]++; i < queues[q].size() && !stopped; i = next[q]++) {
+                const HashJob& job = jobs[queues[q][i]];
+                if(policy.stop && policy.stop(job)) {
+                    stopped = true;
+                    break;
+                }
+                worker(job);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(size_t n=0; n<nodeCount; n++) {
+        for(size_t w=0; w<workers[n]; w++) {
+            threads.emplace_back(loop, n);
+        }
+    }
+
+    for(auto& thread: threads) {
+        thread.join();
+    }
+}
+
+/*
+    jobs of a device with a limit wait in a queue of their own, all other
+    jobs in one shared queue, each keeping the largest first order. a
+    worker takes the largest job at the head of a queue whose device has a
+    free slot, so a saturated disk never holds a worker that could read
+    from another one. it only waits when every job left is on a saturated
+    device. with numa, workers are pinned like in runOnNodes and prefer
+    the jobs of their node
+*/
+void Scheduler::runLimited(
+    const std::vector<HashJob>& jobs,
+    size_t threadCount,
+    const std::function<void(const HashJob&)>& worker,
+    const RunPolicy& policy
+) {
+    struct Lane {
+        std::deque<size_t> jobs;
+        int limit = 0;      // 0 = no limit
+        int running = 0;
+    };
+
+    // lane 0 is the shared one
+    std::vector<Lane> lanes(1);
+    std::map<uint64_t, size_t> laneOf;
+    for(const auto& [device, limit]: policy.deviceLimits) {
+        if(limit <= 0) continue;
+        laneOf[device] = lanes.size();
+        lanes.emplace_back();
+        lanes.back().limit = limit;
+    }
+
+    for(size_t i=0; i<jobs.size(); i++) {
+        auto it = laneOf.find(jobs[i].device);
+        lanes[it != laneOf.end() ? it->second : 0].jobs.push_back(i);
+    }
+
+    std::mutex mutex;
+    std::condition_variable freed;
+    bool stopped = false;
+
+    auto loop = [&](int home) {
+        if(home >= 0) {
+            Numa::bindThread(home);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while(!stopped) {
+            size_t best = lanes.size();
+            bool waiting = false;
+            for(size_t l=0; l<lanes.size(); l++) {
+                const Lane& lane = lanes[l];
+                if(lane.jobs.empty()) continue;
+                if(lane.limit > 0 && lane.running >= lane.limit) {
+                    waiting = true;
+                    continue;
+                }
+                if(best == lanes.size()) {
+                    best = l;
+                    continue;
+                }
+
+                // own node first, then the largest job
+                const HashJob& candidate = jobs[lane.jobs.front()];
+                const HashJob& current = jobs[lanes[best].jobs.front()];
+                bool candidateLocal = candidate.node < 0 || candidate.node == home;
+                bool currentLocal = current.node < 0 || current.node == home;
+                if(candidateLocal != currentLocal ? candidateLocal : candidate.cost > current.cost) {
+                    best = l;
+                }
+            }
+
+            if(best == lanes.size()) {
+                if(!waiting) break;
+                freed.wait(lock);
+                continue;
+            }
+
+            Lane& lane = lanes[best];
+            size_t j = lane.jobs.front();
+            lane.jobs.pop_front();
+            if(policy.stop && policy.stop(jobs[j])) {
+                stopped = true;
+                freed.notify_all();
+                break;
+            }
+
+            lane.running++;
+            lock.unlock();
+            worker(jobs[j]);
+            lock.lock();
+            lane.running--;
+            freed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    if(policy.numa && Numa::available()) {
+        std::vector<size_t> workers = workersPerNode(threadCount);
+        for(size_t n=0; n<workers.size(); n++) {
+            for(size_t w=0; w<workers[n]; w++) {
+                threads.emplace_back(loop, static_cast<int>(n));
+            }
+        }
+    } else {
+        for(size_t t=0; t<threadCount; t++) {
+            threads.emplace_back(loop, -1);
+        }
+    }
+
+    for(auto& thread: threads) {
+        thread.join();
+    }
+}
+
+void Scheduler::parallelFor(
+    size_t count,
+    int numThreads,
+    const std::function<void(size_t)>& task
+) {
+    if(count == 0) {
+        return;
+    }
+
+    size_t threadCount = std::min<size_t>(resolveThreadCount(numThreads), count);
+    if(threadCount == 1) {
+        for(size_t i=0; i<count; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto loop = [&]() {
+        for(size_t i = next++; i < count; i = next++) {
+            task(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(size_t t=1; t<threadCount; t++) {
+        threads.emplace_back(loop);
+    }
+    loop();
+
+    for(auto& thread: threads) {
+        thread.join();
+    }
+}
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "dupesweep/types.h"
+#include "dupesweep/constants.h"
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace dupesweep {
+    // a unit of hashing work handed to one worker
+    struct HashJob {
+        // indices into the caller's work list
+        // small lane: many files, large lane: exactly one
+        std::vector<size_t> items;
+
+        // byte range of a segment when a very large file is split
+        bool isSegment = false;
+        size_t segment = 0;
+        FileSize offset = 0;
+        FileSize length = 0;
+
+        // estimated bytes to read, used for ordering
+        FileSize cost = 0;
+
+        // preferred NUMA node (position in Numa::nodes()), -1 = any
+        int node = -1;
+
+        // device (st_dev) of the files, set when jobs are built per device
+        uint64_t device = 0;
+    };
+
+    // when to cut a file into segments that are hashed as separate jobs
+    struct SplitPolicy {
+        FileSize minBytes = 0;      // 0 = never split
+        FileSize segmentBytes = 0;
+    };
+
+    // how Scheduler::run hands out jobs
+    struct RunPolicy {
+        // a worker pool per NUMA node (only on multi node machines)
+        bool numa = false;
+
+        // checked before each job is taken, once it returns true that
+        // job and all the jobs after it are skipped
+        std::function<bool(const HashJob&)> stop;
+
+        // at most this many jobs of a device run at once. a worker passes
+        // over a saturated device and takes a job of another one
+        std::map<uint64_t, int> deviceLimits;
+    };
+
+    class Scheduler {
+    public:
+        //build jobs for files with the given read costs
+        //small files are batched, large files get their own job and
+        //files of at least split.minBytes are cut into segments
+        //with devices (aligned with costs) a batch never mixes devices
+        //the result is ordered largest first (LPT scheduling)
+        static std::vector<HashJob> buildJobs(
+            const std::vector<FileSize>& costs,
+            const SplitPolicy& split = {},
+            const std::vector<uint64_t>& devices = {}
+        );
+
+        //number of segments a file of this size is split into (0 = not split)
+        static size_t segmentCount(FileSize size, const SplitPolicy& split);
+
+        //run the jobs on numThreads workers
+        //each worker pulls the next job in order until none remain
+        //with policy.numa set on a multi node machine there is a worker
+        //pool per node and jobs go to the pool of their node
+        static void run(
+            const std::vector<HashJob>& jobs,
+            int numThreads,
+            const std::function<void(const HashJob&)>& worker,
+            const RunPolicy& policy = {}
+        );
+
+        //run task(0) .. task(count-1) on up to numThreads workers
+        static void parallelFor(
+            size_t count,
+            int numThreads,
+            const std::function<void(size_t)>& task
+        );
+
+        //resolve the thread count (0 = hardware concurrency)
+        static int resolveThreadCount(int numThreads);
+
+        //stable sort on up to numThreads workers: chunks are sorted in
+        //parallel, then merged pairwise, also in parallel
+        template<typename T, typename Compare>
+        static void parallelSort(std::vector<T>& items, Compare compare, int numThreads) {
+            size_t n = items.size();
+            size_t chunks = n < PARALLEL_SORT_RECORDS ? 1 : resolveThreadCount(numThreads);
+            if(chunks <= 1) {
+                std::stable_sort(items.begin(), items.end(), compare);
+                return;
+            }
+
+            std::vector<size_t> bounds(chunks + 1);
+            for(size_t c=0; c<=chunks; c++) {
+                bounds[c] = n * c / chunks;
+            }
+
+            auto at = [&items](size_t index) { return items.begin() + index; };
+            parallelFor(chunks, numThreads, [&](size_t c) {
+                std::stable_sort(at(bounds[c]), at(bounds[c + 1]), compare);
+            });
+
+            for(size_t width=1; width<chunks; width*=2) {
+                size_t pairs = (chunks + 2 * width - 1) / (2 * width);
+                parallelFor(pairs, numThreads, [&](size_t p) {
+                    size_t first = p * 2 * width;
+                    size_t middle = std::min(first + width, chunks);
+                    size_t last = std::min(first + 2 * width, chunks);
+                    std::inplace_merge(at(bounds[first]), at(bounds[middle]), at(bounds[last]), compare);
+                });
+            }
+        }
+
+    private:
+        static void runOnNodes(
+            const std::vector<HashJob>& jobs,
+            size_t threadCount,
+            const std::function<void(const HashJob&)>& worker,
+            const RunPolicy& policy
+        );
+
+        static void runLimited(
+            const std::vector<HashJob>& jobs,
+            size_t threadCount,
+            const std::function<void(const HashJob&)>& worker,
+            const RunPolicy& policy
+        );
+    };
+}
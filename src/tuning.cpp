@@ -0,0 +1,293 @@
+#include "tuning.h"
+#include "scheduler.h"
+#include "dupesweep/constants.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dupesweep {
+
+namespace {
+
+// a piece of a file read by one timed reader
+struct Span {
+    const FilePath* path;
+    FileSize offset;
+    FileSize length;
+};
+
+/*
+    hands out file regions that were not read before, so no trial is
+    served from pages an earlier trial brought into the cache
+*/
+class Cursor {
+public:
+    Cursor(const FileList& files, std::vector<FileIndex> order): files(files), order(std::move(order)) {}
+
+    // bytes in pieces of at most pieceBytes, empty if the data runs out
+    std::vector<Span> take(FileSize bytes, FileSize pieceBytes) {
+        std::vector<Span> spans;
+        FileSize taken = 0;
+
+        while(taken < bytes && current < order.size()) {
+            const FileInfo& file = files[order[current]];
+            if(offset >= file.size) {
+                current++;
+                offset = 0;
+                continue;
+            }
+
+            FileSize length = std::min({pieceBytes, bytes - taken, file.size - offset});
+            spans.push_back({&file.path, offset, length});
+            offset += length;
+            taken += length;
+        }
+
+        if(taken < bytes) {
+            spans.clear();
+        }
+        return spans;
+    }
+
+private:
+    const FileList& files;
+    std::vector<FileIndex> order;
+    size_t current = 0;
+    FileSize offset = 0;
+};
+
+FileSize readSpan(const Span& span, std::vector<unsigned char>& buffer) {
+    int fd = ::open(span.path->c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return 0;
+    }
+
+    FileSize done = 0;
+    while(done < span.length) {
+        size_t toRead = std::min<FileSize>(buffer.size(), span.length - done);
+        ssize_t n = ::pread(fd, buffer.data(), toRead, static_cast<off_t>(span.offset + done));
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        done += n;
+    }
+
+    ::close(fd);
+    return done;
+}
+
+// throughput in MB/s of readers reading TUNE_TRIAL_BYTES, nullopt without data
+std::optional<double> trial(Cursor& cursor, size_t readBytes, size_t readers) {
+    std::vector<Span> spans = cursor.take(TUNE_TRIAL_BYTES, TUNE_TRIAL_BYTES / readers);
+    if(spans.empty()) {
+        return std::nullopt;
+    }
+
+    std::vector<FileSize> readBy(readers, 0);
+    auto read = [&](size_t reader) {
+        std::vector<unsigned char> buffer(readBytes);
+        for(size_t s = reader; s < spans.size(); s += readers) {
+            readBy[reader] += readSpan(spans[s], buffer);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(size_t r=1; r<readers; r++) {
+        threads.emplace_back(read, r);
+    }
+    read(0);
+    for(auto& thread: threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    FileSize total = 0;
+    for(FileSize bytes: readBy) {
+        total += bytes;
+    }
+    return total / std::max(seconds, 1e-6) / (1024.0 * 1024.0);
+}
+
+}
+
+/*
+    every size bucket gets its own probe: a small head probe may tell
+    documents apart while large media files of one size only differ near
+    the tail. the sample of a bucket is spread over its size groups. a file
+    counts as eliminated by a probe when no other sampled file of its size
+    group gets the same probe hash. smaller probes and the head come first,
+    so a bigger or moved probe is only chosen when it clearly eliminates more
+*/
+std::map<FileSize, Hashing::Probe> Tuning::chooseProbes(
+    const FileList& files,
+    const FileGroups& sizeGroups,
+    const Hashing::Options& options,
+    Report& report
+) {
+    std::map<FileSize, std::vector<size_t>> byBucket;
+    for(size_t g=0; g<sizeGroups.count(); g++) {
+        FileSize size = sizeGroups.begin(g)->key;
+        if(!Hashing::isSmallFile(size, options)) {
+            byBucket[Hashing::sizeBucket(size)].push_back(g);
+        }
+    }
+
+    // sampled files of all buckets, hashed in one pass
+    std::vector<FileIndex> sample;
+    std::vector<size_t> sampleGroup;
+    std::vector<std::pair<size_t, size_t>> bucketSamples;  // [first, last) in sample
+    for(const auto& [bucket, groups]: byBucket) {
+        size_t first = sample.size();
+        size_t step = std::max<size_t>(1, groups.size() / TUNE_SAMPLE_GROUPS);
+        for(size_t i=0; i<groups.size(); i+=step) {
+            size_t g = groups[i];
+            size_t take = std::min(sizeGroups.size(g), TUNE_SAMPLE_FILES);
+            for(size_t f=0; f<take; f++) {
+                sample.push_back(sizeGroups.begin(g)[f].file);
+                sampleGroup.push_back(g);
+            }
+        }
+        bucketSamples.push_back({first, sample.size()});
+    }
+
+    std::map<FileSize, Hashing::Probe> probes;
+    if(sample.empty()) {
+        return probes;
+    }
+
+    std::vector<Hashing::Probe> candidates;
+    for(size_t bytes: TUNE_PROBE_SIZES) {
+        for(auto location: {Hashing::ProbeLocation::Head, Hashing::ProbeLocation::Middle, Hashing::ProbeLocation::Tail}) {
+            candidates.push_back({bytes, location});
+        }
+    }
+
+    // hashes[c][s]: probe c of sampled file s
+    std::vector<std::vector<std::optional<HashValue>>> hashes(candidates.size(), std::vector<std::optional<HashValue>>(sample.size()));
+    Scheduler::parallelFor(sample.size(), options.numThreads, [&](size_t s) {
+        const FileInfo& file = files[sample[s]];
+        for(size_t c=0; c<candidates.size(); c++) {
+            try {
+                hashes[c][s] = Hashing::quickHash(file.path, file.size, candidates[c]);
+            } catch(const std::exception&) {
+                // unreadable files just don't count as eliminated
+            }
+        }
+    });
+
+    size_t b = 0;
+    for(const auto& [bucket, groups]: byBucket) {
+        auto [first, last] = bucketSamples[b++];
+
+        std::vector<double> rates(candidates.size());
+        for(size_t c=0; c<candidates.size(); c++) {
+            std::map<std::pair<size_t, HashValue>, size_t> seen;
+            for(size_t s=first; s<last; s++) {
+                if(hashes[c][s]) {
+                    seen[{sampleGroup[s], *hashes[c][s]}]++;
+                }
+            }
+
+            size_t eliminated = 0;
+            for(size_t s=first; s<last; s++) {
+                if(hashes[c][s] && seen[{sampleGroup[s], *hashes[c][s]}] == 1) {
+                    eliminated++;
+                }
+            }
+            rates[c] = static_cast<double>(eliminated) / (last - first);
+        }
+
+        double best = *std::max_element(rates.begin(), rates.end());
+        for(size_t c=0; c<candidates.size(); c++) {
+            if(rates[c] >= best - TUNE_PROBE_TOLERANCE) {
+                probes[bucket] = candidates[c];
+                report.buckets.push_back({bucket, candidates[c], last - first, rates[c]});
+                break;
+            }
+        }
+    }
+
+    return probes;
+}
+
+/*
+    devices are probed one after the other so they don't disturb each
+    other. the read size is picked with a single reader, then the number
+    of readers with that read size: an HDD usually peaks at one reader,
+    NVMe and network mounts want several
+*/
+void Tuning::probeDevices(
+    const FileList& files,
+    const FileGroups& sizeGroups,
+    Hashing::Options& options,
+    Report& report
+) {
+    std::map<uint64_t, std::vector<FileIndex>> byDevice;
+    std::unordered_map<uint64_t, FileSize> deviceBytes;
+    for(const KeyedFile& record: sizeGroups.records) {
+        const FileInfo& file = files[record.file];
+        if(!Hashing::isSmallFile(file.size, options)) {
+            byDevice[file.device].push_back(record.file);
+            deviceBytes[file.device] += file.size;
+        }
+    }
+
+    size_t maxReaders = std::min(Scheduler::resolveThreadCount(options.numThreads), 16);
+
+    for(auto& [device, candidates]: byDevice) {
+        if(deviceBytes[device] < TUNE_MIN_DEVICE_BYTES) continue;
+
+        // largest files first, long sequential regions
+        std::sort(candidates.begin(), candidates.end(), [&files](FileIndex a, FileIndex b) {
+            return files[a].size > files[b].size;
+        });
+        Cursor cursor(files, candidates);
+
+        Hashing::DeviceSettings settings;
+        double bestRead = 0;
+        for(size_t readBytes: TUNE_READ_SIZES) {
+            std::optional<double> speed = trial(cursor, readBytes, 1);
+            if(!speed) break;
+            if(*speed > bestRead) {
+                bestRead = *speed;
+                settings.readBytes = readBytes;
+            }
+        }
+        if(bestRead == 0) continue;
+
+        std::vector<std::pair<size_t, double>> levels{{1, bestRead}};
+        for(size_t readers = 2; readers <= maxReaders; readers *= 2) {
+            std::optional<double> speed = trial(cursor, settings.readBytes, readers);
+            if(!speed) break;
+            levels.push_back({readers, *speed});
+        }
+
+        double best = 0;
+        for(const auto& [readers, speed]: levels) {
+            best = std::max(best, speed);
+        }
+
+        size_t chosen = levels.back().first;
+        for(const auto& [readers, speed]: levels) {
+            if(speed >= best * TUNE_CONCURRENCY_TOLERANCE) {
+                chosen = readers;
+                break;
+            }
+        }
+
+        // the best level being the widest one tried means no limit
+        settings.concurrency = chosen >= maxReaders ? 0 : chosen;
+        options.devices[device] = settings;
+        report.devices.push_back({device, settings, best});
+    }
+}
+
+}
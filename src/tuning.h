@@ -0,0 +1,56 @@
+#pragma once
+
+#include "dupesweep/types.h"
+#include "hashing.h"
+#include <map>
+#include <vector>
+
+namespace dupesweep {
+    /*
+        adaptive choice of the hashing parameters that depend on the data
+        and the hardware: the quick hash probes (from the size groups) and
+        the read size and concurrency of each device (from timed reads)
+    */
+    class Tuning {
+    public:
+        struct DeviceReport {
+            uint64_t device;
+            Hashing::DeviceSettings settings;
+            double megabytesPerSecond;
+        };
+
+        // probe of the larger files from bucket up to twice its size
+        struct BucketReport {
+            FileSize bucket;
+            Hashing::Probe probe;
+            size_t sampledFiles = 0;
+            double eliminationRate = 0;     // of the chosen probe
+        };
+
+        // what was chosen, for the stats output
+        struct Report {
+            bool enabled = false;
+            bool probeReused = false;       // taken from a checkpoint
+            std::vector<BucketReport> buckets;
+            std::vector<DeviceReport> devices;
+        };
+
+        //pick, per size bucket, the probe that eliminates the most
+        //sampled candidates of that bucket
+        static std::map<FileSize, Hashing::Probe> chooseProbes(
+            const FileList& files,
+            const FileGroups& sizeGroups,
+            const Hashing::Options& options,
+            Report& report
+        );
+
+        //time reads on every device holding enough large candidates
+        //and store the chosen settings in options.devices
+        static void probeDevices(
+            const FileList& files,
+            const FileGroups& sizeGroups,
+            Hashing::Options& options,
+            Report& report
+        );
+    };
+}